@@ -0,0 +1,157 @@
+#!/bin/bash
+# IPC benchmark driver: sweeps mechanism x message size x message count x queue depth,
+# runs every point REPEAT times with sender/receiver pinned to their own CPUs and
+# writes mean / stddev of each metric as CSV (or JSON with FORMAT=json).
+#
+#   make bench                                     # default sweep, results in bench.csv
+#   MECHANISMS="1 3" SIZES="64 4096" COUNTS=100000 DEPTHS="1 8" REPEAT=5 ./bench.sh
+#
+# sizes above 1023 bytes go through the fragment / arena path; 1048576 (1 MiB) is in the default
+# sweep for the large-message comparison, e.g. SIZES="65536 1048576 4194304" for up to 4 MiB.
+# MAX_BYTES caps the input of one point: count is lowered to MAX_BYTES / size (the count column
+# reports the count actually sent), so large sizes do not need gigabytes of input.
+# depth: mechanism 1 uses the lockstep handshake for depth 1 and "-q depth" otherwise
+# (depth is limited by /proc/sys/fs/mqueue/msg_max unless run as root),
+# mechanism 3 uses depth as the ring slot count (power of 2), mechanism 2 has one slot.
+# transport backends 5 ~ 10 (fifo, seqpacket, sysv, eventfd, vmsplice, uring) run at depth 1 only,
+# except eventfd (8), which uses depth as its ring slot count like mechanism 3.
+# uring (10) uses depth as the number of 64 KiB io_uring write buffers.
+# COALESCE=usec runs the sender with "-b usec", packing short lines into one transfer.
+# CREDITS=max runs mechanisms 1 and 2 with "-C max" (credit flow control) instead of the
+# one-message handshake; use DEPTHS=1 with it, since the window replaces the queue depth.
+
+MECHANISMS=${MECHANISMS:-"1 2 3"}
+SIZES=${SIZES:-"16 256 1000 65536 1048576"}
+COUNTS=${COUNTS:-"10000 100000"}
+DEPTHS=${DEPTHS:-"1 8 256"}
+REPEAT=${REPEAT:-3}
+SENDER_CPU=${SENDER_CPU:-0}
+RECEIVER_CPU=${RECEIVER_CPU:-1}
+FORMAT=${FORMAT:-csv}
+OUT=${OUT:-bench.$FORMAT}
+COALESCE=${COALESCE:-}
+CREDITS=${CREDITS:-}
+MAX_BYTES=${MAX_BYTES:-268435456}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# 只有一顆 CPU 時兩邊都綁在 CPU 0
+if [ "$(nproc)" -le "$RECEIVER_CPU" ]; then
+    RECEIVER_CPU=$SENDER_CPU
+fi
+if command -v taskset > /dev/null; then
+    PIN_SENDER="taskset -c $SENDER_CPU"
+    PIN_RECEIVER="taskset -c $RECEIVER_CPU"
+fi
+
+gen_input(){ # gen_input <line size> <line count> <file>
+    # 每行 size - 1 個字元加上換行，超過 1023 bytes 的行會走 fragment / arena
+    # 以倍增接出長行，不用 sprintf("%*s")：mawk 的 sprintf buffer 只有 8 KiB
+    awk -v size=$1 -v count=$2 'BEGIN {
+        line = "x"
+        while(length(line) < size - 1) line = line line
+        line = substr(line, 1, size - 1)
+        for(i = 0; i < count; i++) print line
+    }' > "$3"
+}
+
+depth_args(){ # depth_args <mechanism> <depth>
+    if [ -n "$CREDITS" ] && { [ "$1" -eq 1 ] || [ "$1" -eq 2 ]; }; then
+        echo "-C $CREDITS"
+    elif [ "$1" -eq 3 ] || [ "$1" -eq 8 ] || [ "$1" -eq 10 ] || { [ "$1" -eq 1 ] && [ "$2" -gt 1 ]; }; then
+        echo "-q $2"
+    fi
+}
+
+valid_point(){ # valid_point <mechanism> <depth>
+    case $1 in
+        2|5|6|7|9) [ "$2" -eq 1 ] ;;
+        3|8) [ $(( $2 & ($2 - 1) )) -eq 0 ] ;;
+        *) true ;;
+    esac
+}
+
+run_point(){ # run_point <mechanism> <depth> <input file>  ->  "wall_s msg_s mb_s p50 p99 p999 max"
+    local args start end
+    args=$(depth_args $1 $2)
+    rm -f /dev/shm/shm_ring /dev/shm/shm_sync /dev/shm/shm_comm /dev/shm/shm_arena /dev/shm/shm_efd
+    # receiver 先啟動並等待 sender 建立共享資源，latency 與 wall time 才不會包含啟動時間
+    # -o quiet：不逐則輸出訊息，量到的是 transport 而不是 terminal / pipe
+    $PIN_RECEIVER ./receiver -o quiet $args $1 | grep -E '^(Latency|Throughput)' > "$TMP/receiver.out" &
+    sleep 0.05
+    start=$(date +%s%N)
+    $PIN_SENDER ./sender -o quiet $args ${COALESCE:+-b $COALESCE} $1 "$3" > /dev/null
+    wait
+    end=$(date +%s%N)
+    awk -v wall=$(( end - start )) '
+        /^Latency/    { gsub(/,/, ""); p50 = $4; p90 = $6; p99 = $8; p999 = $10; max = $12 }
+        /^Throughput/ { gsub(/,/, ""); msgs = $2; mbs = $4 }
+        END { print wall / 1e9, msgs, mbs, p50, p99, p999, max }' "$TMP/receiver.out"
+}
+
+METRICS="wall_s msg_per_s mb_per_s p50_ns p99_ns p999_ns max_ns"
+
+for mechanism in $MECHANISMS; do
+    for size in $SIZES; do
+        done_counts=" "
+        for count in $COUNTS; do
+            if [ $(( size * count )) -gt $MAX_BYTES ]; then
+                count=$(( MAX_BYTES / size > 0 ? MAX_BYTES / size : 1 ))
+            fi
+            case "$done_counts" in *" $count "*) continue ;; esac # 多個 COUNTS 被壓成同一個值
+            done_counts="$done_counts$count "
+            gen_input $size $count "$TMP/input.txt"
+            for depth in $DEPTHS; do
+                valid_point $mechanism $depth || continue
+                echo "mechanism $mechanism, size $size, count $count, depth $depth" >&2
+                for r in $(seq $REPEAT); do
+                    echo "$mechanism $size $count $depth $(run_point $mechanism $depth "$TMP/input.txt")"
+                done
+            done
+        done
+    done
+done > "$TMP/raw.txt"
+
+# 同一組 (mechanism, size, count, depth) 的 REPEAT 次結果取 mean 與 sample stddev
+awk -v format=$FORMAT -v metrics="$METRICS" '
+    BEGIN { n_metrics = split(metrics, name, " ") }
+    {
+        key = $1 " " $2 " " $3 " " $4
+        if(!(key in runs)) order[++n_keys] = key
+        runs[key]++
+        for(i = 1; i <= n_metrics; i++){
+            sum[key, i] += $(i + 4)
+            sq[key, i] += $(i + 4) * $(i + 4)
+        }
+    }
+    END {
+        if(format == "json") print "["
+        else{
+            printf "mechanism,size,count,depth,runs"
+            for(i = 1; i <= n_metrics; i++) printf ",%s_mean,%s_stddev", name[i], name[i]
+            printf "\n"
+        }
+        for(k = 1; k <= n_keys; k++){
+            key = order[k]; n = runs[key]
+            split(key, f, " ")
+            if(format == "json")
+                printf "  {\"mechanism\": %s, \"size\": %s, \"count\": %s, \"depth\": %s, \"runs\": %d", f[1], f[2], f[3], f[4], n
+            else
+                printf "%s,%s,%s,%s,%d", f[1], f[2], f[3], f[4], n
+            for(i = 1; i <= n_metrics; i++){
+                mean = sum[key, i] / n
+                var = n > 1 ? (sq[key, i] - n * mean * mean) / (n - 1) : 0
+                sd = var > 0 ? sqrt(var) : 0
+                if(format == "json")
+                    printf ", \"%s_mean\": %.6g, \"%s_stddev\": %.6g", name[i], mean, name[i], sd
+                else
+                    printf ",%.6g,%.6g", mean, sd
+            }
+            if(format == "json") printf "}%s\n", k < n_keys ? "," : ""
+            else printf "\n"
+        }
+        if(format == "json") print "]"
+    }' "$TMP/raw.txt" > "$OUT"
+
+echo "results written to $OUT" >&2
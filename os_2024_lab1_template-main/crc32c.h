@@ -0,0 +1,96 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/*
+ * CRC32C(Castagnoli，多項式 0x82F63B78 reflected)，用來檢查 frame 的 payload。
+ * x86-64 且 CPU 支援 SSE4.2 時使用 crc32 指令，一次處理 8 bytes；
+ * 否則使用 slicing-by-8 的查表版本，一次查 8 個表處理 8 bytes。
+ * 是否支援在執行時判斷，不需要以 -msse4.2 編譯。crc32c("123456789") = 0xE3069283。
+ */
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_hw = -1; //-1: 尚未初始化
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p, size_t len){
+    uint64_t crc64 = crc;
+    while(len >= 8){
+        uint64_t word;
+        memcpy(&word, p, 8); //不要求對齊
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while(len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+//slicing-by-8
+static inline uint32_t crc32c_sw(uint32_t crc, const unsigned char* p, size_t len){
+    while(len >= 8){
+        uint32_t low, high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = crc32c_table[7][low & 0xff] ^ crc32c_table[6][(low >> 8) & 0xff] ^
+              crc32c_table[5][(low >> 16) & 0xff] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xff] ^ crc32c_table[2][(high >> 8) & 0xff] ^
+              crc32c_table[1][(high >> 16) & 0xff] ^ crc32c_table[0][high >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while(len--)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+//建立查表版本的 table 並判斷 CPU 是否支援 SSE4.2，第一次呼叫 crc32c 時自動執行
+static inline void crc32c_init(void){
+    for(int i = 0; i < 256; i++){
+        uint32_t crc = i;
+        for(int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][i] = crc;
+    }
+    for(int i = 0; i < 256; i++){
+        for(int k = 1; k < 8; k++)
+            crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[k - 1][i] & 0xff];
+    }
+#if defined(__x86_64__)
+    crc32c_hw = __builtin_cpu_supports("sse4.2");
+#else
+    crc32c_hw = 0;
+#endif
+}
+
+//回傳 data 的 CRC32C；查表版本以 memcpy 讀出的 word 假設 host 為 little endian
+static inline uint32_t crc32c(const void* data, size_t len){
+    uint32_t crc = 0xFFFFFFFFu;
+    if(crc32c_hw == -1)
+        crc32c_init();
+#if defined(__x86_64__)
+    if(crc32c_hw)
+        return ~crc32c_sse42(crc, data, len);
+#endif
+    return ~crc32c_sw(crc, data, len);
+}
+
+static inline const char* crc32c_impl(void){
+    if(crc32c_hw == -1)
+        crc32c_init();
+    return crc32c_hw ? "SSE4.2" : "table";
+}
+
+#endif
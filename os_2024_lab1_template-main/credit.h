@@ -0,0 +1,106 @@
+#ifndef CREDIT_H
+#define CREDIT_H
+
+#include <stdatomic.h>
+#include "ring.h"
+
+/*
+ * Credit-based flow control(-C max，mechanism 1 / 2)：取代一次一則的 send_sem / rec_sem 交握。
+ * send_sem 的 count 就是 sender 手上的 credit，每送出一個 slot 用掉一個，用完才需要等待；
+ * receiver 讀完後先累積，一次歸還半個 window，sender 不必每則都等一次 round trip。
+ * 在途中的訊息最多 window 則(window <= max)，佇列 / slot 數固定為 max，記憶體有上限。
+ *
+ * window 依 consumer lag 調整：
+ *   連續 CREDIT_HYSTERESIS 次歸還時佇列中的訊息都已達 window 的 3/4
+ *       consumer 跟不上，再大的 window 也只是堆積，減半讓 sender 提早停下來
+ *   連續 CREDIT_HYSTERESIS 次歸還時 sender 都等過 credit，而佇列中的訊息不超過 window 的一半
+ *       consumer 跟得上，是 window 太小，加倍(最多 max)
+ * 縮小時少還的 credit 記在 pending(負數)，之後讀完的訊息先抵掉，不會把已發出的 credit 收回。
+ */
+#define CREDIT_INITIAL 4 //一開始的 window，之後依 sender 是否等待再放大
+#define CREDIT_MIN 2 //window 下限，至少讓 sender 寫下一則時 receiver 還在讀上一則
+#define CREDIT_HYSTERESIS 4 //只有一次可能只是 receiver 剛好沒被排程到，不調整
+
+//放在 /shm_sync 中 fsync_t 之後，sender 與 receiver 都可以輸出
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_ulong sent; //sender 已送出的 slot 數，receiver 用來計算 lag
+    _Alignas(CACHE_LINE) atomic_uint window; //receiver 目前的 window
+    atomic_ulong stalls; //sender 用完 credit 而必須等待的次數
+    atomic_ulong grants; //receiver 歸還 credit 的次數
+    atomic_ulong grows;
+    atomic_ulong shrinks;
+} credit_shared_t;
+
+typedef struct {
+    unsigned int max;
+    unsigned int window;
+    long pending; //已讀完但還沒還給 sender 的 credit
+    unsigned long received; //receiver 已讀完的 slot 數
+    unsigned long last_stalls;
+    unsigned int lagging; //連續幾次歸還時 consumer 落後
+    unsigned int starved; //連續幾次歸還時 sender 等過 credit 而 consumer 跟得上
+} credit_t;
+
+static inline unsigned int credit_initial(unsigned int max){
+    return max < CREDIT_INITIAL ? max : CREDIT_INITIAL;
+}
+
+static inline unsigned int credit_min(unsigned int max){
+    return max < CREDIT_MIN ? max : CREDIT_MIN;
+}
+
+static inline void credit_init(credit_t* credit, credit_shared_t* shared, unsigned int max){
+    credit -> max = max;
+    credit -> window = credit_initial(max);
+    credit -> pending = 0;
+    credit -> received = 0;
+    credit -> last_stalls = atomic_load(&shared -> stalls);
+    credit -> lagging = 0;
+    credit -> starved = 0;
+    atomic_store(&shared -> window, credit -> window);
+}
+
+//receiver 讀完一個 slot，累積到半個 window 時回傳 1，表示應該呼叫 credit_grant
+static inline int credit_consumed(credit_t* credit){
+    credit -> received++;
+    credit -> pending++;
+    return credit -> pending >= (long)(credit -> window + 1) / 2;
+}
+
+//receiver 沒有訊息可讀、即將 block：sender 可能正在等 credit，手上的 credit 要先還回去
+static inline int credit_idle(credit_t* credit, credit_shared_t* shared){
+    return credit -> pending > 0 && atomic_load(&shared -> sent) == credit -> received;
+}
+
+//依 consumer lag 調整 window，回傳這次要還給 sender 的 credit 數
+static inline unsigned int credit_grant(credit_t* credit, credit_shared_t* shared){
+    unsigned long backlog = atomic_load(&shared -> sent) - credit -> received;
+    unsigned long stalls = atomic_load(&shared -> stalls);
+    unsigned int old_window = credit -> window;
+    unsigned int granted;
+    credit -> lagging = backlog * 4 >= (unsigned long)credit -> window * 3 ? credit -> lagging + 1 : 0;
+    credit -> starved = stalls != credit -> last_stalls && backlog * 2 <= credit -> window ? credit -> starved + 1 : 0;
+    if(credit -> lagging >= CREDIT_HYSTERESIS && credit -> window > credit_min(credit -> max)){
+        credit -> window /= 2;
+        if(credit -> window < credit_min(credit -> max))
+            credit -> window = credit_min(credit -> max);
+        credit -> lagging = 0;
+        atomic_fetch_add(&shared -> shrinks, 1);
+    }
+    else if(credit -> starved >= CREDIT_HYSTERESIS && credit -> window < credit -> max){
+        credit -> window = credit -> window * 2 < credit -> max ? credit -> window * 2 : credit -> max;
+        credit -> starved = 0;
+        atomic_fetch_add(&shared -> grows, 1);
+    }
+    credit -> last_stalls = stalls;
+    credit -> pending += (long)credit -> window - (long)old_window;
+    atomic_store(&shared -> window, credit -> window);
+    if(credit -> pending <= 0)
+        return 0;
+    granted = credit -> pending;
+    credit -> pending = 0;
+    atomic_fetch_add(&shared -> grants, 1);
+    return granted;
+}
+
+#endif
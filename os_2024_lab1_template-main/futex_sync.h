@@ -0,0 +1,214 @@
+#ifndef FUTEX_SYNC_H
+#define FUTEX_SYNC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ring.h"
+#include "timing.h"
+
+#define SYNC_NAME "/shm_sync"
+#define SYNC_SPINS 1000 //預設最多忙等次數，可用 -s 調整，0 表示每次都直接睡
+
+/*
+ * 放在共享記憶體中的 semaphore，取代 sem_open 的 named semaphore。
+ * count 同時是 futex word；waiters 記錄正在 FUTEX_WAIT 的行程數，
+ * post 時只有真的有人在睡才呼叫 FUTEX_WAKE，雙方都在忙時完全不需要 syscall。
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_uint count;
+    atomic_uint waiters;
+} fsem_t;
+
+typedef struct {
+    fsem_t send_sem; //sender 等待，receiver post
+    fsem_t rec_sem; //receiver 等待，sender post
+    _Alignas(CACHE_LINE) atomic_int ready;
+} fsync_t;
+
+//每個行程自己的忙等狀態，依照最近忙等是否成功調整下一次的忙等長度
+typedef struct {
+    int max_spins;
+    int spins;
+} fsem_spin_t;
+
+static inline long futex_call(atomic_uint* uaddr, int op, unsigned int val){
+    //共享記憶體跨行程使用，不能加 FUTEX_PRIVATE_FLAG
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static inline void fsem_init(fsem_t* sem, unsigned int value){
+    atomic_store(&sem -> count, value);
+    atomic_store(&sem -> waiters, 0);
+}
+
+static inline int fsem_try_wait(fsem_t* sem){
+    unsigned int count = atomic_load_explicit(&sem -> count, memory_order_relaxed);
+    while(count > 0){
+        if(atomic_compare_exchange_weak_explicit(&sem -> count, &count, count - 1, memory_order_acquire, memory_order_relaxed))
+            return 1;
+    }
+    return 0;
+}
+
+static inline void fsem_spin_init(fsem_spin_t* spin, int max_spins){
+    //單核心時對方在我們忙等的期間無法執行，忙等一定失敗，直接睡
+    spin -> max_spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? max_spins : 0;
+    spin -> spins = spin -> max_spins / 2;
+}
+
+static inline void fsem_wait(fsem_t* sem, fsem_spin_t* spin){
+    //忙等上限為最近平均成功次數的 2 倍：成功時往實際次數靠近，失敗(還是得睡)時縮短 1/8
+    int limit = spin -> spins * 2 + 10;
+    int count = 0;
+    if(limit > spin -> max_spins)
+        limit = spin -> max_spins;
+    while(count < limit){
+        if(fsem_try_wait(sem)){
+            spin -> spins += (count - spin -> spins) / 8;
+            return;
+        }
+        ring_cpu_relax();
+        count++;
+    }
+    spin -> spins -= spin -> spins / 8;
+
+    while(!fsem_try_wait(sem)){
+        //先登記 waiters 再檢查 count (皆為 seq_cst)，與 fsem_post 的順序相反，保證不會漏掉 wake
+        atomic_fetch_add(&sem -> waiters, 1);
+        if(atomic_load(&sem -> count) == 0)
+            futex_call(&sem -> count, FUTEX_WAIT, 0); //count 已不是 0 時會立刻回傳 EAGAIN
+        atomic_fetch_sub(&sem -> waiters, 1);
+    }
+}
+
+static inline void fsem_post(fsem_t* sem){
+    atomic_fetch_add(&sem -> count, 1);
+    if(atomic_load(&sem -> waiters) > 0) //對方沒有在睡就不需要 syscall
+        futex_call(&sem -> count, FUTEX_WAKE, 1);
+}
+
+//一次加 n(credit.h 一次歸還多個 credit)，只需要一次 wake
+static inline void fsem_post_n(fsem_t* sem, unsigned int n){
+    atomic_fetch_add(&sem -> count, n);
+    if(atomic_load(&sem -> waiters) > 0)
+        futex_call(&sem -> count, FUTEX_WAKE, n);
+}
+
+/*
+ * -w poll：mechanism 2 不用 semaphore，sender / receiver 各自忙等 /shm_comm 中的 sequence counter，
+ * 交握完全不進 kernel。written 由 sender、consumed 由 receiver 遞增：
+ * 兩者相等時 slot 空著(sender 可寫)，written 較大時 slot 有訊息(receiver 可讀)。
+ * 只比較共享的計數，不保留本地狀態，所以先啟動的一方或上次留下的 segment 都不影響。
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_ulong written;
+    _Alignas(CACHE_LINE) atomic_ulong consumed;
+} poll_seq_t;
+
+//忙等花掉的時間與次數，結束時與 CPU time 一起輸出
+typedef struct {
+    long long idle_ns;
+    unsigned long long polls;
+} poll_stats_t;
+
+//poll_seq_t 接在 message 之後並從新的 cache line 開始，不與 message 共用 cache line
+static inline size_t poll_shm_size(size_t message_size){
+    return ring_slot_size(message_size) + sizeof(poll_seq_t);
+}
+
+static inline poll_seq_t* poll_seq(void* shm_addr, size_t message_size){
+    return (poll_seq_t*)((char*)shm_addr + ring_slot_size(message_size));
+}
+
+static inline void poll_relax(void){
+    static int single_cpu = -1;
+    if(single_cpu == -1)
+        single_cpu = sysconf(_SC_NPROCESSORS_ONLN) == 1;
+    if(single_cpu) //單核心時對方必須拿到 CPU 才能前進，忙等只會用完整個 time slice
+        sched_yield();
+    else
+        ring_cpu_relax();
+}
+
+static inline long long poll_clock(void){
+    return timing_now_ns();
+}
+
+static inline int poll_slot_free(poll_seq_t* seq){
+    return atomic_load_explicit(&seq -> consumed, memory_order_acquire) == atomic_load_explicit(&seq -> written, memory_order_relaxed);
+}
+
+static inline int poll_has_message(poll_seq_t* seq){
+    return atomic_load_explicit(&seq -> written, memory_order_acquire) != atomic_load_explicit(&seq -> consumed, memory_order_relaxed);
+}
+
+//sender：忙等 receiver 讀完，只有真的需要等時才讀時間
+static inline void poll_wait_free(poll_seq_t* seq, poll_stats_t* stats){
+    long long start;
+    if(poll_slot_free(seq))
+        return;
+    start = poll_clock();
+    do{
+        poll_relax();
+        stats -> polls++;
+    }while(!poll_slot_free(seq));
+    stats -> idle_ns += poll_clock() - start;
+}
+
+//receiver：忙等 sender 寫入下一則訊息
+static inline void poll_wait_message(poll_seq_t* seq, poll_stats_t* stats){
+    long long start;
+    if(poll_has_message(seq))
+        return;
+    start = poll_clock();
+    do{
+        poll_relax();
+        stats -> polls++;
+    }while(!poll_has_message(seq));
+    stats -> idle_ns += poll_clock() - start;
+}
+
+static inline void poll_publish(poll_seq_t* seq){
+    atomic_fetch_add_explicit(&seq -> written, 1, memory_order_release);
+}
+
+static inline void poll_consume(poll_seq_t* seq){
+    atomic_fetch_add_explicit(&seq -> consumed, 1, memory_order_release);
+}
+
+//-c cpu：把目前的行程綁在指定的 CPU 上(直接呼叫 sched_setaffinity syscall，不需要 _GNU_SOURCE 的 cpu_set_t)
+static inline void pin_cpu(int cpu){
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {0};
+    if(cpu < 0 || cpu >= 1024){
+        printf("Invalid CPU %d\n", cpu);
+        exit(1);
+    }
+    mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+    if(syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == -1){
+        perror("sched_setaffinity failed");
+        exit(1);
+    }
+}
+
+static inline double process_cpu_seconds(void){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+static inline void poll_print(poll_stats_t* stats, int cpu){
+    if(cpu >= 0)
+        printf("Busy-poll on CPU %d: ", cpu);
+    else
+        printf("Busy-poll: ");
+    printf("idle spin %.6f s (%llu polls), process CPU time %.6f s\n", stats -> idle_ns * 1e-9, stats -> polls, process_cpu_seconds());
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef HUB_H
+#define HUB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "ring.h"
+
+#define HUB_NAME "/shm_hub"
+#define HUB_CHANNELS 256 //一個 hub 最多同時存在的 channel 數
+#define HUB_SLOTS 64 //每個 channel 的 ring 預設 slot 數，必須為 2 的次方
+#define HUB_NAME_MAX 48
+#define HUB_PAGE 4096
+
+/*
+ * Channel hub：一塊共享記憶體 /shm_hub 中放很多個互相獨立的 channel。
+ * 開頭是 directory(channel 名稱 -> id)，之後每個 channel 各有一個固定大小的 SPSC ring，
+ * channel id 就是 ring 在 hub 中的序號，ring 的 head / tail 即為該 channel 送出 / 讀完的訊息數。
+ *
+ * 整個 hub 在建立時就 ftruncate 成最大的大小，tmpfs 只有實際寫到的頁面才會配置記憶體；
+ * 同一個行程中開第二個以後的 channel 沿用已經 mmap 的 hub，只需要在 directory 中登記，
+ * 不必再 shm_open / mmap。directory 的修改(開 / 關 channel、行程連上 / 離開)以 spinlock 保護，
+ * 只在建立與結束時發生，傳送訊息時不會碰到。
+ *
+ * receiver 讀完結束訊息後釋放 channel；沒有行程連上且所有 channel 都已釋放時，最後離開的行程移除 hub。
+ */
+#define HUB_FREE 0
+#define HUB_USED 1
+
+typedef struct {
+    char name[HUB_NAME_MAX];
+    atomic_int state; //HUB_FREE / HUB_USED
+    int creator_pid; //建立這個 channel 的行程
+    unsigned long long opened; //這個 channel 被 sender / receiver 連上的次數
+} hub_entry_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int lock;
+    atomic_int ready; //建立者初始化完成後設為 1
+    int closed; //已被 shm_unlink，之後連上的行程要重新建立
+    int processes; //目前連上的行程數
+    unsigned int in_use; //HUB_USED 的 channel 數
+    unsigned int slots; //每個 channel 的 ring slot 數，以建立者為準
+    unsigned int slot_size;
+    size_t channel_bytes; //一個 channel 的 ring 大小(cache line 的倍數)
+    _Alignas(CACHE_LINE) hub_entry_t entries[HUB_CHANNELS];
+} hub_dir_t;
+
+//directory 佔用的大小，以 page 為單位，channel 的 ring 從下一個 page 開始
+static inline size_t hub_dir_bytes(void){
+    return (sizeof(hub_dir_t) + HUB_PAGE - 1) & ~(size_t)(HUB_PAGE - 1);
+}
+
+static inline size_t hub_bytes(unsigned int slots, unsigned int slot_size){
+    return hub_dir_bytes() + (size_t)HUB_CHANNELS * ring_bytes(slots, slot_size);
+}
+
+static inline ring_t* hub_ring(hub_dir_t* hub, int id){
+    return (ring_t*)((char*)hub + hub_dir_bytes() + (size_t)id * hub -> channel_bytes);
+}
+
+static inline void hub_lock(hub_dir_t* hub){
+    unsigned int spins = 0;
+    while(atomic_exchange_explicit(&hub -> lock, 1, memory_order_acquire))
+        ring_backoff(&spins);
+}
+
+static inline void hub_unlock(hub_dir_t* hub){
+    atomic_store_explicit(&hub -> lock, 0, memory_order_release);
+}
+
+/*
+ * 連上 hub，不存在時以 O_EXCL 建立，slots 只在建立時使用。
+ * 連上時 hub 剛好被最後一個行程移除(closed)就重新開一次，會建立新的 hub。
+ */
+static inline hub_dir_t* hub_open(unsigned int slots, size_t message_size){
+    unsigned int slot_size = ring_slot_size(message_size);
+    while(1){
+        size_t size = hub_bytes(slots, slot_size);
+        int creator = 1;
+        struct stat st;
+        hub_dir_t* hub;
+        int shm_fd = shm_open(HUB_NAME, O_CREAT | O_EXCL | O_RDWR, 0666);
+        if(shm_fd == -1 && errno == EEXIST){
+            creator = 0;
+            shm_fd = shm_open(HUB_NAME, O_RDWR, 0666);
+            if(shm_fd == -1 && errno == ENOENT) //建立者之外的行程剛好把它移除
+                continue;
+        }
+        if(shm_fd == -1){
+            perror("shm_open failed");
+            exit(1);
+        }
+        if(creator){
+            if(ftruncate(shm_fd, size) == -1){
+                perror("ftruncate failed");
+                exit(1);
+            }
+        }
+        else{
+            while(1){ //等建立者 ftruncate
+                if(fstat(shm_fd, &st) == -1){
+                    perror("fstat failed");
+                    exit(1);
+                }
+                if(st.st_size >= (off_t)hub_dir_bytes())
+                    break;
+                usleep(1000);
+            }
+            size = st.st_size;
+        }
+        hub = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        if(hub == MAP_FAILED){
+            perror("mmap failed");
+            exit(1);
+        }
+        close(shm_fd);
+        if(creator){
+            hub -> slots = slots;
+            hub -> slot_size = slot_size;
+            hub -> channel_bytes = ring_bytes(slots, slot_size);
+            atomic_store_explicit(&hub -> ready, 1, memory_order_release);
+        }
+        else{
+            while(!atomic_load_explicit(&hub -> ready, memory_order_acquire))
+                usleep(1000);
+        }
+        hub_lock(hub);
+        if(!hub -> closed){
+            hub -> processes++;
+            hub_unlock(hub);
+            return hub;
+        }
+        hub_unlock(hub);
+        munmap(hub, size);
+    }
+}
+
+static inline size_t hub_size(hub_dir_t* hub){
+    return hub_bytes(hub -> slots, hub -> slot_size);
+}
+
+//依名稱找到 channel，不存在時建立並初始化它的 ring；回傳 channel id，hub 已滿時回傳 -1
+static inline int hub_channel_open(hub_dir_t* hub, const char* name){
+    int id = -1;
+    hub_lock(hub);
+    for(int i = 0; i < HUB_CHANNELS; i++){
+        hub_entry_t* entry = &hub -> entries[i];
+        if(atomic_load_explicit(&entry -> state, memory_order_relaxed) == HUB_USED && strncmp(entry -> name, name, HUB_NAME_MAX) == 0){
+            id = i;
+            break;
+        }
+        if(id == -1 && atomic_load_explicit(&entry -> state, memory_order_relaxed) == HUB_FREE)
+            id = -2 - i; //第一個空的 entry，找不到同名的 channel 時使用
+    }
+    if(id <= -2){
+        hub_entry_t* entry = &hub -> entries[-2 - id];
+        id = -2 - id;
+        snprintf(entry -> name, HUB_NAME_MAX, "%s", name);
+        entry -> creator_pid = getpid();
+        entry -> opened = 0;
+        ring_init(hub_ring(hub, id), hub -> slots, hub -> slot_size);
+        atomic_store_explicit(&entry -> state, HUB_USED, memory_order_relaxed);
+        hub -> in_use++;
+    }
+    if(id >= 0)
+        hub -> entries[id].opened++;
+    hub_unlock(hub);
+    return id;
+}
+
+//receiver 讀完後釋放 channel，id 可以給之後的 channel 使用
+static inline void hub_channel_free(hub_dir_t* hub, int id){
+    hub_lock(hub);
+    if(atomic_load_explicit(&hub -> entries[id].state, memory_order_relaxed) == HUB_USED){
+        atomic_store_explicit(&hub -> entries[id].state, HUB_FREE, memory_order_relaxed);
+        hub -> in_use--;
+    }
+    hub_unlock(hub);
+}
+
+//離開 hub，沒有其他行程且沒有 channel 還在使用時移除 hub
+static inline void hub_close(hub_dir_t* hub){
+    size_t size = hub_size(hub);
+    hub_lock(hub);
+    hub -> processes--;
+    if(hub -> processes == 0 && hub -> in_use == 0){
+        hub -> closed = 1;
+        shm_unlink(HUB_NAME);
+    }
+    hub_unlock(hub);
+    munmap(hub, size);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef IPC_NAMES_H
+#define IPC_NAMES_H
+
+#include <stdio.h>
+#include <limits.h>
+#include "ring.h"
+#include "futex_sync.h"
+#include "mpmc.h"
+
+#define QUEUE_NAME "/posix_queue"
+#define SHM_NAME "/shm_comm"
+#define ARENA_NAME "/shm_arena"
+#define SEND_SEM_NAME "/send_sem"
+#define REC_SEM_NAME "/rec_sem"
+#define FIFO_NAME "/tmp/ipc_fifo"     //named pipe 的路徑
+#define SPLICE_NAME "/tmp/ipc_splice" //vmsplice 使用的 named pipe
+#define SOCKET_NAME "ipc_socket"      //abstract namespace，不會在檔案系統留下檔案
+#define EFD_NAME "/shm_efd"           //eventfd + shared memory ring，同名的 abstract socket 用來傳遞 eventfd
+#define SYSV_NAME "/sysv_msg"         //hash 成 System V message queue 的 key
+
+/*
+ * sender / receiver 使用的所有 IPC 物件名稱。
+ * 指定 -n channel 時每個名稱後面加上 ".channel"，同一台機器上可以同時跑多組互不干擾。
+ */
+typedef struct {
+    char queue[NAME_MAX];
+    char shm[NAME_MAX];
+    char arena[NAME_MAX];
+    char ring[NAME_MAX];
+    char sync[NAME_MAX];
+    char mpmc[NAME_MAX];
+    char send_sem[NAME_MAX];
+    char rec_sem[NAME_MAX];
+    char fifo[NAME_MAX];
+    char splice[NAME_MAX];
+    char socket[NAME_MAX];
+    char efd[NAME_MAX];
+    char sysv[NAME_MAX];
+} ipc_names_t;
+
+static inline void ipc_name(char* name, const char* base, const char* channel){
+    if(channel)
+        snprintf(name, NAME_MAX, "%s.%s", base, channel);
+    else
+        snprintf(name, NAME_MAX, "%s", base);
+}
+
+static inline void ipc_names_init(ipc_names_t* names, const char* channel){
+    ipc_name(names -> queue, QUEUE_NAME, channel);
+    ipc_name(names -> shm, SHM_NAME, channel);
+    ipc_name(names -> arena, ARENA_NAME, channel);
+    ipc_name(names -> ring, RING_NAME, channel);
+    ipc_name(names -> sync, SYNC_NAME, channel);
+    ipc_name(names -> mpmc, MPMC_NAME, channel);
+    ipc_name(names -> send_sem, SEND_SEM_NAME, channel);
+    ipc_name(names -> rec_sem, REC_SEM_NAME, channel);
+    ipc_name(names -> fifo, FIFO_NAME, channel);
+    ipc_name(names -> splice, SPLICE_NAME, channel);
+    ipc_name(names -> socket, SOCKET_NAME, channel);
+    ipc_name(names -> efd, EFD_NAME, channel);
+    ipc_name(names -> sysv, SYSV_NAME, channel);
+}
+
+#endif
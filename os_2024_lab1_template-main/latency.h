@@ -0,0 +1,109 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include "timing.h"
+
+/*
+ * HDR 風格的 latency histogram：以 2 的次方分段，每段再切成 2^LAT_SUB_BITS 個 bucket，
+ * 所以任何數值的相對誤差都在 1/16 以內，而且 record 只需要幾個位元運算。
+ * 小於 2^LAT_SUB_BITS 的數值每個 ns 各自一個 bucket(精確值)。
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB_COUNT (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS (64 * LAT_SUB_COUNT)
+
+typedef struct {
+    unsigned long long counts[LAT_BUCKETS];
+    unsigned long long total; //筆數
+    unsigned long long max;
+    unsigned long long bytes; //累計 payload 大小，用來算 bytes/s
+} latency_hist_t;
+
+//CLOCK_MONOTONIC 的 ns，有 invariant TSC 時以 rdtscp 換算(見 timing.h)
+static inline long long now_ns(void){
+    return timing_now_ns();
+}
+
+static inline int lat_index(unsigned long long value){
+    int exponent, block;
+    if(value < LAT_SUB_COUNT)
+        return value;
+    exponent = 63 - __builtin_clzll(value);
+    block = exponent - LAT_SUB_BITS + 1;
+    return block * LAT_SUB_COUNT + ((value >> (block - 1)) & (LAT_SUB_COUNT - 1));
+}
+
+//bucket 所涵蓋的最小值
+static inline unsigned long long lat_lower(int index){
+    int block = index / LAT_SUB_COUNT;
+    if(block == 0)
+        return index;
+    return (unsigned long long)(LAT_SUB_COUNT + index % LAT_SUB_COUNT) << (block - 1);
+}
+
+//bucket 所涵蓋的最大值
+static inline unsigned long long lat_upper(int index){
+    int block = index / LAT_SUB_COUNT;
+    if(block == 0)
+        return index;
+    return lat_lower(index) + (1ULL << (block - 1)) - 1;
+}
+
+static inline void lat_record(latency_hist_t* hist, long long value, size_t bytes){
+    if(value < 0) //兩邊的 timestamp 有些許誤差時視為 0
+        value = 0;
+    hist -> counts[lat_index(value)]++;
+    hist -> total++;
+    hist -> bytes += bytes;
+    if((unsigned long long)value > hist -> max)
+        hist -> max = value;
+}
+
+//回傳 percentile (0 ~ 100) 所在 bucket 的上界，不超過實際最大值
+static inline unsigned long long lat_percentile(latency_hist_t* hist, double percentile){
+    unsigned long long target = (unsigned long long)(hist -> total * percentile / 100.0 + 0.5);
+    unsigned long long seen = 0;
+    if(target == 0)
+        target = 1;
+    for(int i = 0; i < LAT_BUCKETS; i++){
+        seen += hist -> counts[i];
+        if(seen >= target)
+            return lat_upper(i) < hist -> max ? lat_upper(i) : hist -> max;
+    }
+    return hist -> max;
+}
+
+static inline void lat_print(latency_hist_t* hist, double seconds){
+    if(hist -> total == 0)
+        return;
+    printf("Latency (ns): p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+           lat_percentile(hist, 50), lat_percentile(hist, 90), lat_percentile(hist, 99),
+           lat_percentile(hist, 99.9), hist -> max);
+    printf("Throughput: %.0f msg/s, %.2f MB/s\n", hist -> total / seconds, hist -> bytes / seconds / (1 << 20));
+}
+
+//priority lanes 各自一行，只列出 percentile
+static inline void lat_print_lane(latency_hist_t* hist, unsigned int lane){
+    if(hist -> total == 0){
+        printf("Lane %u: 0 messages\n", lane);
+        return;
+    }
+    printf("Lane %u: %llu messages, latency (ns) p50 %llu, p99 %llu, max %llu\n", lane, hist -> total,
+           lat_percentile(hist, 50), lat_percentile(hist, 99), hist -> max);
+}
+
+//只輸出有資料的 bucket：lower_ns,upper_ns,count
+static inline int lat_dump_csv(latency_hist_t* hist, const char* path){
+    FILE* file = fopen(path, "w");
+    if(!file)
+        return -1;
+    fprintf(file, "lower_ns,upper_ns,count\n");
+    for(int i = 0; i < LAT_BUCKETS; i++){
+        if(hist -> counts[i])
+            fprintf(file, "%llu,%llu,%llu\n", lat_lower(i), lat_upper(i), hist -> counts[i]);
+    }
+    return fclose(file);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef LINESCAN_H
+#define LINESCAN_H
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * 找出 [p, end) 中第一個 '\n'，找不到時回傳 end。
+ * glibc 的 memchr 在執行時依 CPU 選擇 SSE2 / AVX2 / EVEX 的版本，長行時比自己寫的向量迴圈快，
+ * 短行時也差不多，所以直接使用 memchr。
+ */
+static inline const char* scan_newline(const char* p, const char* end){
+    const char* hit = memchr(p, '\n', end - p);
+    return hit ? hit : end;
+}
+
+#endif
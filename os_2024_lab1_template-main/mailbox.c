@@ -0,0 +1,1363 @@
+#include "mailbox.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <mqueue.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ring.h"
+#include "futex_sync.h"
+#include "latency.h"
+#include "mpmc.h"
+#include "placement.h"
+#include "ipc_names.h"
+#include "transport.h"
+#include "credit.h"
+#include "crc32c.h"
+#include "seqlock.h"
+#include "hub.h"
+
+#define ARENA_INIT_SIZE (1 << 20)
+
+//priority lanes：較高的 lane 可以插在某則訊息的 fragment 之間，receiver 每個 lane 各自重組
+typedef struct {
+    char* buf;
+    size_t len, cap;
+    long long send_ns; //第一個 fragment 的時間
+} lane_partial_t;
+
+//同一個行程中所有 hub channel 共用一次 mmap，最後一個 channel 關閉時才離開 hub
+static hub_dir_t* hub_mapping;
+static int hub_refs;
+
+struct mailbox {
+    int role;
+    int flag; // 1 for message passing, 2 for shared memory, 3 for ring buffer, 4 for MPMC queue, 5 ~ 10 for transport.h backends
+    union{
+        mqd_t mqdes;
+        char* shm_addr;
+        seqlock_t* seqlock; //mechanism 2 的 conflating 模式
+        ring_t* ring;
+        mpmc_t* mpmc;
+        transport_t* transport; //fifo, seqpacket, sysv, eventfd, vmsplice, uring
+    }storage;
+    const transport_ops_t* transport_ops;
+    int pipelined; //pipelined message passing: 由 queue 本身的 blocking 控制流量
+    int handshake; //mechanism 1 (lockstep) / 2 需要交握
+    unsigned int credits; //credit flow control 的 window 上限，0 為一次一則的交握
+    unsigned int lanes; //priority lane 數量，1 為不分 lane
+    int lane; //sender：目前這則訊息的 lane
+    int peek_lane; //receiver：ring buffer 目前這個 slot 所在的 lane
+    ring_t* lane_rings[MAILBOX_LANES]; //ring buffer 每個 lane 一個 ring，依序放在同一塊共享記憶體中
+    unsigned int seq[MAILBOX_LANES]; //sender：各 lane 下一個 frame 的 seq；receiver：預期的下一個 seq
+    int checksum;
+    int hub_id; //ring buffer 放在 channel hub 中時的 channel id，否則為 -1
+    int conflate; //mechanism 2 的 conflating(latest-value)模式：sender 不等待，receiver 只取最新的 value
+    unsigned int conflate_version; //receiver：上次讀到的 version
+    int wait;
+    int expected_producers;
+    int consumer_id;
+    ipc_names_t names; //指定 channel 時所有 IPC 物件名稱都會加上 channel
+    placement_t placement;
+    char description[64];
+    //shared memory 傳送超過 MSG_DATA_SIZE 的訊息時，payload 放在另一塊共享記憶體 /shm_arena
+    char* arena_addr;
+    size_t arena_size;
+    int arena_fd;
+    message_t staging; //message passing / transport 沒有共享的 slot，sender 在這裡組好、receiver 收進這裡
+    fsem_spin_t spin;
+    fsync_t* sync_ptr;
+    size_t sync_size;
+    sem_t *send_sem, *rec_sem;
+    poll_seq_t* poll_ptr;
+    poll_stats_t poll_stats;
+    credit_shared_t* credit_shared; //在 /shm_sync 中 fsync_t 之後
+    credit_t credit; //receiver
+    unsigned long slot_seq; //sender：credit 模式下 mechanism 2 已 commit 的 slot 數
+    size_t shm_size;
+    int fragment_warned;
+    //sender：已 reserve、正在打包的 batch
+    message_t* batch;
+    long long batch_start_ns;
+    //receiver：目前這次傳輸的 slot(尚未 release)，cursor 為下一則還沒交出去的訊息，NULL 表示已全部交出
+    message_t* current;
+    const char* cursor;
+    const char* end;
+    int eof;
+    char* large_buf; //重組 fragment 用的 buffer，只會變大不會縮小
+    size_t large_cap;
+    lane_partial_t partial[MAILBOX_LANES];
+    mailbox_stats_t stats;
+    long long first_send_ns, last_recv_ns;
+};
+
+void mailbox_config_init(mailbox_config_t* config){
+    memset(config, 0, sizeof(mailbox_config_t));
+    config -> wait = MAILBOX_WAIT_FUTEX;
+    config -> spins = SYNC_SPINS;
+    config -> producers = 1;
+}
+
+int mailbox_mechanism(mailbox_t* mailbox){
+    return mailbox -> flag;
+}
+
+const char* mailbox_describe(mailbox_t* mailbox){
+    return mailbox -> description;
+}
+
+//receiver 把累積的 credit 還給 sender，同時依 lag 調整 window
+static void credit_return(mailbox_t* mailbox){
+    unsigned int granted = credit_grant(&mailbox -> credit, mailbox -> credit_shared);
+    if(granted)
+        fsem_post_n(&mailbox -> sync_ptr -> send_sem, granted);
+}
+
+/*
+ * credit 模式：send_sem 為 sender 手上的 credit，mechanism 2 的 rec_sem 為已寫好的 slot 數，
+ * mechanism 1 由 mq_receive 本身等待訊息。
+ */
+static void credit_wait(mailbox_t* mailbox){
+    if(mailbox -> role == MAILBOX_SENDER){
+        if(!fsem_try_wait(&mailbox -> sync_ptr -> send_sem)){ //credit 用完，等 receiver 歸還
+            atomic_fetch_add(&mailbox -> credit_shared -> stalls, 1);
+            fsem_wait(&mailbox -> sync_ptr -> send_sem, &mailbox -> spin);
+        }
+        return;
+    }
+    if(credit_idle(&mailbox -> credit, mailbox -> credit_shared)) //沒有訊息在途中，sender 可能在等 credit
+        credit_return(mailbox);
+    if(mailbox -> flag == 2)
+        fsem_wait(&mailbox -> sync_ptr -> rec_sem, &mailbox -> spin);
+}
+
+static void credit_post(mailbox_t* mailbox){
+    if(mailbox -> role == MAILBOX_SENDER){
+        atomic_fetch_add(&mailbox -> credit_shared -> sent, 1);
+        if(mailbox -> flag == 2)
+            fsem_post(&mailbox -> sync_ptr -> rec_sem);
+    }
+    else if(credit_consumed(&mailbox -> credit)){
+        credit_return(mailbox);
+    }
+}
+
+static void handshake_wait(mailbox_t* mailbox){
+    int sender = mailbox -> role == MAILBOX_SENDER;
+    if(mailbox -> credits){
+        credit_wait(mailbox);
+    }
+    else if(mailbox -> wait == MAILBOX_WAIT_POLL){
+        if(sender)
+            poll_wait_free(mailbox -> poll_ptr, &mailbox -> poll_stats);
+        else
+            poll_wait_message(mailbox -> poll_ptr, &mailbox -> poll_stats);
+    }
+    else if(mailbox -> wait == MAILBOX_WAIT_FUTEX)
+        fsem_wait(sender ? &mailbox -> sync_ptr -> send_sem : &mailbox -> sync_ptr -> rec_sem, &mailbox -> spin);
+    else
+        sem_wait(sender ? mailbox -> send_sem : mailbox -> rec_sem);
+}
+
+static void handshake_post(mailbox_t* mailbox){
+    int sender = mailbox -> role == MAILBOX_SENDER;
+    if(mailbox -> credits){
+        credit_post(mailbox);
+    }
+    else if(mailbox -> wait == MAILBOX_WAIT_POLL){
+        if(sender)
+            poll_publish(mailbox -> poll_ptr);
+        else
+            poll_consume(mailbox -> poll_ptr);
+    }
+    else if(mailbox -> wait == MAILBOX_WAIT_FUTEX)
+        fsem_post(sender ? &mailbox -> sync_ptr -> rec_sem : &mailbox -> sync_ptr -> send_sem);
+    else
+        sem_post(sender ? mailbox -> rec_sem : mailbox -> send_sem);
+}
+
+//mechanism 2 的 slot：一次一則時只有一個，credit 模式下有 credits 個依序輪流使用
+static message_t* shm_slot(mailbox_t* mailbox, unsigned long seq){
+    if(!mailbox -> credits)
+        return (message_t*)mailbox -> storage.shm_addr;
+    return (message_t*)(mailbox -> storage.shm_addr + (seq % mailbox -> credits) * ring_slot_size(sizeof(message_t)));
+}
+
+/*
+ * Zero-copy：slot_reserve() 回傳下一個可寫入的 message_t，
+ * shared memory / ring buffer 時直接指向共享記憶體中的 slot，填好 data 與 size 後
+ * 呼叫 slot_commit() 交給 receiver，只有實際寫入的 size bytes 會經過共享記憶體。
+ */
+static message_t* slot_reserve(mailbox_t* mailbox){
+    if(mailbox -> flag == 1){
+        return &mailbox -> staging;
+    }
+    else if(mailbox -> flag == 2){
+        if(mailbox -> conflate) //在 staging 組好後一次發布，seqlock 為奇數的時間只有複製的那一段
+            return &mailbox -> staging;
+        return shm_slot(mailbox, mailbox -> slot_seq); //由交握保證 receiver 已讀完
+    }
+    else if(mailbox -> flag == 3){
+        ring_t* ring = mailbox -> lane_rings[mailbox -> lane];
+        void* slot;
+        unsigned int spins = 0;
+        while((slot = ring_try_reserve(ring)) == NULL){ //佇列已滿，等待 receiver 釋放 slot
+            ring_backoff(&spins);
+        }
+        return slot;
+    }
+    else if(mailbox -> flag == 4){
+        void* slot;
+        unsigned int spins = 0;
+        while((slot = mpmc_try_reserve(mailbox -> storage.mpmc)) == NULL){ //所有 slot 都還沒被 receiver 讀走
+            ring_backoff(&spins);
+        }
+        return slot;
+    }
+    transport_t* transport = mailbox -> storage.transport;
+    return transport -> ops -> reserve(transport); //backend 自己的 buffer，send 時不需再複製
+}
+
+static void slot_commit(mailbox_t* mailbox, message_t* message){
+    //送出 raw 的 TSC tick，由 receiver 以同一份校正換算 send 與 recv 的時間，兩個行程各自校正的誤差不會混在 latency 中
+    message -> send_ns = timing_now_stamp();
+    if(timing_clock.tsc)
+        message -> flags |= MSG_TSC;
+    message -> flags |= mailbox -> lane << MSG_LANE_SHIFT;
+    message -> seq = mailbox -> seq[mailbox -> lane]++;
+    if(mailbox -> checksum){
+        message -> flags |= MSG_CRC;
+        message -> crc = crc32c(message -> flags & MSG_ARENA ? mailbox -> arena_addr : message -> data, message -> size);
+        mailbox -> stats.checksummed++;
+    }
+    mailbox -> stats.transfers++;
+    if(mailbox -> flag == 1){
+        //header(size, flags) 與 data 一起送出，只送有效的 size bytes；lane 即為 mq 的 priority，priority 高的先被收走
+        if(mq_send(mailbox -> storage.mqdes, (const char*)message, offsetof(message_t, data) + message -> size, mailbox -> lane) == -1){
+            perror("mq_send failed");
+            exit(1);
+        }
+    }
+    else if(mailbox -> flag == 2 && mailbox -> conflate){
+        seqlock_publish(mailbox -> storage.seqlock, message, offsetof(message_t, data) + message -> size); //覆蓋 receiver 還沒讀的 value
+    }
+    else if(mailbox -> flag == 2){
+        mailbox -> slot_seq++; //資料已在共享記憶體中，由交握通知 receiver
+    }
+    else if(mailbox -> flag == 3){
+        ring_commit(mailbox -> lane_rings[mailbox -> lane]);
+    }
+    else if(mailbox -> flag == 4){
+        mpmc_commit(message);
+    }
+    else if(mailbox -> flag >= TRANSPORT_FIRST){
+        transport_t* transport = mailbox -> storage.transport;
+        transport -> ops -> send(transport, message, offsetof(message_t, data) + message -> size);
+    }
+}
+
+/*
+ * conflating 模式的 receiver：等到比上次新的 version，把 value 複製進 staging。
+ * 複製期間 sender 又寫入時重試；version 相差 2k 表示中間有 k - 1 個 value 被覆蓋而沒有讀到。
+ */
+static message_t* conflate_peek(mailbox_t* mailbox){
+    seqlock_t* lock = mailbox -> storage.seqlock;
+    message_t* message = &mailbox -> staging;
+    unsigned int spins = 0;
+    while(1){
+        unsigned int version = seqlock_version(lock);
+        size_t size;
+        if((version & 1) || version == mailbox -> conflate_version){ //寫入中，或還沒有新的 value
+            ring_backoff(&spins);
+            continue;
+        }
+        memcpy(message, lock -> value, offsetof(message_t, data));
+        size = (unsigned int)message -> size < MSG_DATA_SIZE ? message -> size : 0; //torn read 時 size 可能是任意值
+        memcpy(message -> data, lock -> value + offsetof(message_t, data), size);
+        if(seqlock_retry(lock, version)){
+            mailbox -> stats.torn_reads++;
+            continue;
+        }
+        mailbox -> stats.conflated += (version - mailbox -> conflate_version) / 2 - 1;
+        mailbox -> conflate_version = version;
+        message -> data[size] = '\0';
+        return message;
+    }
+}
+
+/*
+ * ring buffer 的 receiver：由最高的 lane 往下找第一個有訊息的 ring，都為空時回傳 NULL。
+ * 在較低的 lane 找到時再檢查一次較高的 lane：sender 在這則之前 commit 的訊息此時一定看得到，
+ * 先前檢查時還沒寫入的也不會被跳過(例如 lane 0 的結束訊息不會比更早送出的高 lane 訊息先被處理)。
+ */
+static message_t* lane_peek(mailbox_t* mailbox){
+    for(int lane = mailbox -> lanes - 1; lane >= 0; lane--){
+        void* slot = ring_try_peek(mailbox -> lane_rings[lane]);
+        if(!slot)
+            continue;
+        for(int higher = mailbox -> lanes - 1; higher > lane; higher--){
+            void* urgent = ring_try_peek(mailbox -> lane_rings[higher]);
+            if(urgent){
+                slot = urgent;
+                lane = higher;
+                break;
+            }
+        }
+        mailbox -> peek_lane = lane;
+        return slot;
+    }
+    return NULL;
+}
+
+//receiver 端：回傳下一個 slot，MPMC 所有 sender 都已結束且佇列已空時回傳 NULL
+static message_t* slot_peek(mailbox_t* mailbox){
+    if(mailbox -> flag == 1){
+        //header 與 data 一起收進 staging，staging.size 由 sender 填入
+        ssize_t received_bytes = mq_receive(mailbox -> storage.mqdes, (char*)&mailbox -> staging, sizeof(message_t), NULL);
+        if(received_bytes == -1){ //sizeof(message_t): attr.mq_msgsize, NULL: priority(lane)已記在 flags 中
+            perror("mq_receive failed");
+            exit(1);
+        }
+        mailbox -> staging.data[mailbox -> staging.size] = '\0'; //sender 每個 slot 最多 MSG_DATA_SIZE - 1 bytes
+        return &mailbox -> staging;
+    }
+    else if(mailbox -> flag == 2){
+        if(mailbox -> conflate)
+            return conflate_peek(mailbox);
+        return shm_slot(mailbox, mailbox -> credit.received); //由交握保證 sender 已寫完
+    }
+    else if(mailbox -> flag == 3){
+        void* slot;
+        unsigned int spins = 0;
+        while((slot = lane_peek(mailbox)) == NULL){ //佇列為空，等待 sender 寫入
+            ring_backoff(&spins);
+        }
+        return slot;
+    }
+    else if(mailbox -> flag == 4){
+        mpmc_t* queue = mailbox -> storage.mpmc;
+        void* slot;
+        unsigned int spins = 0;
+        while(1){
+            //先讀 producers 再 peek：sender 在 commit 完所有訊息後才會離開，讀到 0 時佇列中已經是全部的訊息
+            int producers = atomic_load(&queue -> producers);
+            int seen = atomic_load(&queue -> producers_seen);
+            if((slot = mpmc_try_peek(queue)) != NULL)
+                return slot;
+            if(producers == 0 && seen >= mailbox -> expected_producers)
+                return NULL;
+            ring_backoff(&spins);
+        }
+    }
+    transport_t* transport = mailbox -> storage.transport;
+    size_t len = transport -> ops -> recv(transport, &mailbox -> staging, sizeof(message_t));
+    if(len < offsetof(message_t, data) || (size_t)mailbox -> staging.size >= MSG_DATA_SIZE){
+        printf("Malformed message from transport %s\n", transport -> ops -> name);
+        exit(1);
+    }
+    mailbox -> staging.data[mailbox -> staging.size] = '\0';
+    return &mailbox -> staging;
+}
+
+static void slot_release(mailbox_t* mailbox, message_t* message){
+    if(mailbox -> flag == 3){
+        ring_release(mailbox -> lane_rings[mailbox -> peek_lane]);
+    }
+    else if(mailbox -> flag == 4){
+        mpmc_release(mailbox -> storage.mpmc, message);
+    }
+    //flag == 2: 由交握把共享記憶體還給 sender
+}
+
+/*
+ * sender 端：確保 arena 至少有 size bytes，不夠時以 2 倍成長。
+ * arena 是 shm 物件，重新 mmap 後原本寫入的內容仍然存在。
+ */
+static char* arena_reserve(mailbox_t* mailbox, size_t size){
+    size_t new_size;
+    if(size <= mailbox -> arena_size)
+        return mailbox -> arena_addr;
+
+    new_size = mailbox -> arena_size ? mailbox -> arena_size : ARENA_INIT_SIZE;
+    while(new_size < size)
+        new_size *= 2;
+    new_size = place_size(&mailbox -> placement, new_size);
+    if(mailbox -> arena_fd == -1){ //第一次遇到大訊息時才建立 arena
+        place_shm_unlink(&mailbox -> placement, mailbox -> names.arena);
+        mailbox -> arena_fd = place_shm_open(&mailbox -> placement, mailbox -> names.arena, O_CREAT | O_RDWR, 0666);
+        if(mailbox -> arena_fd == -1){
+            perror("shm_open failed");
+            exit(1);
+        }
+    }
+    if(ftruncate(mailbox -> arena_fd, new_size) == -1){
+        perror("ftruncate failed");
+        exit(1);
+    }
+    if(mailbox -> arena_addr)
+        munmap(mailbox -> arena_addr, mailbox -> arena_size);
+    mailbox -> arena_addr = place_mmap(&mailbox -> placement, new_size, mailbox -> arena_fd, mailbox -> names.arena);
+    if(mailbox -> arena_addr == MAP_FAILED){
+        perror("mmap failed");
+        exit(1);
+    }
+    mailbox -> arena_size = new_size;
+    return mailbox -> arena_addr;
+}
+
+//receiver 端 MSG_ARENA：sender 可能已經把 arena 放大，必要時重新 mmap
+static char* arena_attach(mailbox_t* mailbox, size_t size){
+    struct stat st;
+    if(mailbox -> arena_fd == -1){
+        mailbox -> arena_fd = place_shm_open(&mailbox -> placement, mailbox -> names.arena, O_RDWR, 0666);
+        if(mailbox -> arena_fd == -1){
+            perror("shm_open failed");
+            exit(1);
+        }
+    }
+    if(size >= mailbox -> arena_size){
+        if(fstat(mailbox -> arena_fd, &st) == -1){
+            perror("fstat failed");
+            exit(1);
+        }
+        if(mailbox -> arena_addr)
+            munmap(mailbox -> arena_addr, mailbox -> arena_size);
+        mailbox -> arena_addr = place_mmap(&mailbox -> placement, st.st_size, mailbox -> arena_fd, mailbox -> names.arena);
+        if(mailbox -> arena_addr == MAP_FAILED){
+            perror("mmap failed");
+            exit(1);
+        }
+        mailbox -> arena_size = st.st_size;
+    }
+    return mailbox -> arena_addr;
+}
+
+//MPMC 時同一則訊息的 fragment 可能被不同 receiver 拿走而無法重組，只能當成各自獨立的訊息送出
+static int fragment_flags(mailbox_t* mailbox){
+    if(mailbox -> flag != 4)
+        return MSG_MORE;
+    if(!mailbox -> fragment_warned){
+        fprintf(stderr, "Messages longer than %d bytes are split into separate messages in MPMC mode\n", MSG_DATA_SIZE - 1);
+        mailbox -> fragment_warned = 1;
+    }
+    return 0;
+}
+
+/*
+ * Coalescing：連續的短訊息打包進同一個 slot(MSG_BATCH)，一次 commit 交給 receiver，
+ * 每則不必各付一次 mq_send / 交握 / ring commit 的成本。
+ * 經過 send_view 的訊息(長訊息、結束訊息)會先把 batch 送出，receiver 看到的順序不變。
+ */
+static void batch_flush(mailbox_t* mailbox){
+    if(!mailbox -> batch)
+        return;
+    mailbox -> batch -> data[mailbox -> batch -> size] = '\0';
+    slot_commit(mailbox, mailbox -> batch);
+    if(mailbox -> handshake)
+        handshake_post(mailbox);
+    mailbox -> batch = NULL;
+    mailbox -> stats.batches++;
+}
+
+void mailbox_batch_add(mailbox_t* mailbox, const void* data, size_t size){
+    message_t* batch;
+    char* record;
+    if(size > BATCH_MAX_RECORD){
+        mailbox_send(mailbox, data, size);
+        return;
+    }
+    if(mailbox -> batch && mailbox -> batch -> size + BATCH_HEADER + size > MSG_DATA_SIZE - 1) //保留最後一個 byte 給 '\0'
+        batch_flush(mailbox);
+    if(!mailbox -> batch){
+        if(mailbox -> handshake)
+            handshake_wait(mailbox);
+        mailbox -> batch = slot_reserve(mailbox);
+        mailbox -> batch -> size = 0;
+        mailbox -> batch -> flags = MSG_BATCH;
+        mailbox -> batch -> opcode = MSG_OP_DATA;
+        mailbox -> batch_start_ns = now_ns();
+    }
+    batch = mailbox -> batch;
+    record = batch -> data + batch -> size;
+    record[0] = size & 0xff;
+    record[1] = size >> 8;
+    memcpy(record + BATCH_HEADER, data, size);
+    batch -> size += BATCH_HEADER + size;
+    mailbox -> stats.messages++;
+    mailbox -> stats.lane_messages[0]++;
+    mailbox -> stats.batched++;
+    mailbox -> stats.bytes += size;
+}
+
+long long mailbox_batch_started(mailbox_t* mailbox){
+    return mailbox -> batch ? mailbox -> batch_start_ns : 0;
+}
+
+void mailbox_send_batch(mailbox_t* mailbox, const struct iovec* messages, int count){
+    for(int i = 0; i < count; i++)
+        mailbox_batch_add(mailbox, messages[i].iov_base, messages[i].iov_len);
+    batch_flush(mailbox);
+}
+
+void mailbox_flush(mailbox_t* mailbox){
+    batch_flush(mailbox);
+    if(mailbox -> transport_ops && mailbox -> transport_ops -> flush)
+        mailbox -> transport_ops -> flush(mailbox -> storage.transport);
+}
+
+/*
+ * 把一則訊息(不一定以 '\0' 結尾)交給 mailbox：
+ * 短的訊息複製一次進 slot，超過 MSG_DATA_SIZE - 1 的訊息放進 arena(shared memory)或切成 fragment。
+ */
+static void send_view(mailbox_t* mailbox, const char* data, size_t size, int lane, int opcode){
+    int posted = 0;
+    message_t* message;
+    batch_flush(mailbox); //batch 一律在 lane 0
+    if(mailbox -> conflate && size >= MSG_DATA_SIZE){
+        //fragment 可能被覆蓋而無法重組，只保留開頭
+        if(!mailbox -> fragment_warned){
+            fprintf(stderr, "Messages longer than %d bytes are truncated in conflating mode\n", MSG_DATA_SIZE - 1);
+            mailbox -> fragment_warned = 1;
+        }
+        size = MSG_DATA_SIZE - 1;
+    }
+    mailbox -> lane = lane;
+    if(mailbox -> handshake)
+        handshake_wait(mailbox);
+    message = slot_reserve(mailbox);
+    message -> flags = 0;
+    message -> opcode = opcode;
+
+    if(size >= MSG_DATA_SIZE && mailbox -> flag == 2 && !mailbox -> credits){
+        //single slot 每個 fragment 都要一次交握，改成整則放進 arena 一次交給 receiver
+        //(credit 模式下同時有多則訊息在途中，arena 只有一塊，改用 fragment)
+        char* arena = arena_reserve(mailbox, size + 1);
+        memcpy(arena, data, size);
+        arena[size] = '\0';
+        message -> size = size;
+        message -> flags = MSG_ARENA;
+        mailbox -> stats.arena++;
+    }
+    else{
+        while(size >= MSG_DATA_SIZE){
+            memcpy(message -> data, data, MSG_DATA_SIZE - 1);
+            message -> size = MSG_DATA_SIZE - 1;
+            message -> flags = fragment_flags(mailbox);
+            slot_commit(mailbox, message);
+            mailbox -> stats.fragments++;
+            if(mailbox -> credits){ //每個 fragment 各用一個 credit
+                handshake_post(mailbox);
+                handshake_wait(mailbox);
+            }
+            else if(mailbox -> handshake && !posted){ //depth 1 的 queue 要等 receiver 開始收，後面的 fragment 才送得出去
+                handshake_post(mailbox);
+                posted = 1;
+            }
+            data += MSG_DATA_SIZE - 1;
+            size -= MSG_DATA_SIZE - 1;
+            message = slot_reserve(mailbox);
+            message -> flags = 0;
+            message -> opcode = opcode;
+        }
+        memcpy(message -> data, data, size);
+        message -> data[size] = '\0';
+        message -> size = size;
+    }
+
+    slot_commit(mailbox, message);
+    if(mailbox -> handshake && !posted)
+        handshake_post(mailbox);
+    mailbox -> lane = 0;
+}
+
+void mailbox_send_lane(mailbox_t* mailbox, const void* data, size_t size, int lane){
+    if(lane < 0 || (unsigned int)lane >= mailbox -> lanes){
+        printf("Lane %d out of range (%u lanes)\n", lane, mailbox -> lanes);
+        exit(1);
+    }
+    send_view(mailbox, data, size, lane, MSG_OP_DATA);
+    mailbox -> stats.messages++;
+    mailbox -> stats.bytes += size;
+    mailbox -> stats.lane_messages[lane]++;
+}
+
+void mailbox_send(mailbox_t* mailbox, const void* data, size_t size){
+    mailbox_send_lane(mailbox, data, size, 0);
+}
+
+void mailbox_send_eof(mailbox_t* mailbox){
+    send_view(mailbox, "", 0, 0, MSG_OP_END); //lane 0：排在所有資料之後
+    if(mailbox -> transport_ops && mailbox -> transport_ops -> flush)
+        mailbox -> transport_ops -> flush(mailbox -> storage.transport);
+}
+
+message_t* mailbox_reserve(mailbox_t* mailbox){
+    message_t* message;
+    batch_flush(mailbox);
+    mailbox -> lane = 0;
+    if(mailbox -> handshake)
+        handshake_wait(mailbox);
+    message = slot_reserve(mailbox);
+    message -> size = 0;
+    message -> flags = 0;
+    message -> opcode = MSG_OP_DATA;
+    return message;
+}
+
+void mailbox_commit(mailbox_t* mailbox, message_t* message, size_t size){
+    if(size >= MSG_DATA_SIZE){ //slot 已經交給呼叫者寫入，無法再切成 fragment
+        printf("Reserved message of %zu bytes exceeds %d\n", size, MSG_DATA_SIZE - 1);
+        exit(1);
+    }
+    message -> size = size;
+    message -> data[size] = '\0';
+    slot_commit(mailbox, message);
+    if(mailbox -> handshake)
+        handshake_post(mailbox);
+    mailbox -> stats.messages++;
+    mailbox -> stats.bytes += size;
+    mailbox -> stats.lane_messages[0]++;
+}
+
+/*
+ * receiver 端：檢查 frame header 後才交給 transfer_next。
+ * size / opcode 超出範圍表示雙方格式不一致或資料已損毀，無法繼續解析；
+ * seq 跳號與 CRC 錯誤只計數，訊息照常交出，由呼叫者從 mailbox_stats 判斷。
+ */
+static void frame_check(mailbox_t* mailbox, message_t* message){
+    if(message -> opcode > MSG_OP_END || message -> size < 0 || (!(message -> flags & MSG_ARENA) && message -> size >= MSG_DATA_SIZE)){
+        printf("Malformed frame (opcode %u, size %d)\n", message -> opcode, message -> size);
+        exit(1);
+    }
+    if(mailbox -> flag != 4 && !mailbox -> conflate){ //MPMC 時每個 receiver 只分到部分的 frame，而且來自多個 sender；conflating 模式本來就會略過
+        unsigned int* expected = &mailbox -> seq[MSG_LANE(message -> flags)];
+        int diff = (int)(message -> seq - *expected);
+        if(diff > 0)
+            mailbox -> stats.seq_lost += diff;
+        else if(diff < 0)
+            mailbox -> stats.seq_reordered++;
+        if(diff >= 0)
+            *expected = message -> seq + 1;
+    }
+    if(message -> flags & MSG_CRC){
+        const char* payload = message -> flags & MSG_ARENA ? arena_attach(mailbox, message -> size) : message -> data;
+        mailbox -> stats.checksummed++;
+        if(crc32c(payload, message -> size) != message -> crc)
+            mailbox -> stats.crc_errors++;
+    }
+}
+
+static message_t* frame_next(mailbox_t* mailbox){
+    message_t* message = slot_peek(mailbox);
+    if(message)
+        frame_check(mailbox, message);
+    return message;
+}
+
+/*
+ * 把 MSG_MORE 的 fragment 依序接成一個連續的 buffer。
+ * 回傳時 *message_pptr 指向最後一個 fragment(尚未 release)，*size_ptr 為整則訊息長度。
+ */
+static char* reassemble(mailbox_t* mailbox, message_t** message_pptr, size_t* size_ptr){
+    message_t* message = *message_pptr;
+    size_t len = 0;
+    while(1){
+        if(len + message -> size + 1 > mailbox -> large_cap){
+            mailbox -> large_cap = mailbox -> large_cap ? mailbox -> large_cap * 2 : (1 << 20);
+            mailbox -> large_buf = realloc(mailbox -> large_buf, mailbox -> large_cap);
+            if(!mailbox -> large_buf){
+                perror("realloc failed");
+                exit(1);
+            }
+            continue;
+        }
+        memcpy(mailbox -> large_buf + len, message -> data, message -> size);
+        len += message -> size;
+        if(!(message -> flags & MSG_MORE))
+            break;
+        slot_release(mailbox, message);
+        if(mailbox -> credits){
+            handshake_post(mailbox);
+            handshake_wait(mailbox);
+        }
+        message = frame_next(mailbox);
+    }
+    mailbox -> large_buf[len] = '\0';
+    *message_pptr = message;
+    *size_ptr = len;
+    return mailbox -> large_buf;
+}
+
+/*
+ * priority lanes 的重組：fragment 先接到所屬 lane 的 buffer，中間可能插進較高 lane 的訊息。
+ * 收到最後一個 fragment 時回傳 1，整則訊息在 partial -> buf 中；否則回傳 0，呼叫者應先 release 這個 slot。
+ */
+static int lane_append(mailbox_t* mailbox, message_t* message){
+    lane_partial_t* partial = &mailbox -> partial[MSG_LANE(message -> flags)];
+    if(partial -> len == 0)
+        partial -> send_ns = message -> send_ns;
+    while(partial -> len + message -> size + 1 > partial -> cap){
+        partial -> cap = partial -> cap ? partial -> cap * 2 : (1 << 16);
+        partial -> buf = realloc(partial -> buf, partial -> cap);
+        if(!partial -> buf){
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    memcpy(partial -> buf + partial -> len, message -> data, message -> size);
+    partial -> len += message -> size;
+    partial -> buf[partial -> len] = '\0';
+    return !(message -> flags & MSG_MORE);
+}
+
+//把目前這次傳輸的 slot 還給 sender
+static void transfer_release(mailbox_t* mailbox){
+    if(!mailbox -> current)
+        return;
+    slot_release(mailbox, mailbox -> current);
+    mailbox -> current = NULL;
+    mailbox -> cursor = NULL;
+    if(mailbox -> handshake)
+        handshake_post(mailbox);
+}
+
+//release 上一次傳輸並取得下一次；收到結束訊息或 MPMC 所有 sender 都已結束時回傳 0
+static int transfer_next(mailbox_t* mailbox){
+    message_t* message;
+    char* payload;
+    size_t size;
+    transfer_release(mailbox);
+    while(1){
+        if(mailbox -> handshake)
+            handshake_wait(mailbox);
+        message = frame_next(mailbox); //直接讀共享記憶體中的 slot，不複製
+        if(message == NULL)
+            return 0;
+        payload = message -> data;
+        size = message -> size;
+        if(message -> flags & MSG_ARENA){
+            payload = arena_attach(mailbox, message -> size);
+            mailbox -> stats.arena++;
+        }
+        else if(mailbox -> lanes > 1 && ((message -> flags & MSG_MORE) || mailbox -> partial[MSG_LANE(message -> flags)].len)){
+            lane_partial_t* partial = &mailbox -> partial[MSG_LANE(message -> flags)];
+            if(!lane_append(mailbox, message)){
+                slot_release(mailbox, message);
+                if(mailbox -> handshake) //credit 模式下每個 fragment 各用一個 credit
+                    handshake_post(mailbox);
+                continue;
+            }
+            payload = partial -> buf;
+            size = partial -> len;
+            partial -> len = 0; //buf 的內容保留到下一次 transfer_next
+            message -> send_ns = partial -> send_ns;
+            mailbox -> stats.fragments++;
+        }
+        else if(message -> flags & MSG_MORE){
+            long long send_ns = message -> send_ns; //分段的訊息以第一個 fragment 的時間為準
+            payload = reassemble(mailbox, &message, &size);
+            message -> send_ns = send_ns;
+            mailbox -> stats.fragments++;
+        }
+        mailbox -> current = message;
+        if(message -> opcode == MSG_OP_END){
+            if(mailbox -> flag == 4){ //每個 sender 各送一次 End，由 producers 計數判斷何時結束
+                transfer_release(mailbox);
+                continue;
+            }
+            return 0;
+        }
+        mailbox -> cursor = payload;
+        mailbox -> end = payload + size;
+        mailbox -> stats.transfers++;
+        if(message -> flags & MSG_BATCH)
+            mailbox -> stats.batches++;
+        mailbox -> last_recv_ns = now_ns();
+        return 1;
+    }
+}
+
+int mailbox_recv_batch(mailbox_t* mailbox, mailbox_msg_t* messages, int max){
+    message_t* current;
+    int count = 0;
+    if(mailbox -> eof)
+        return 0;
+    if(!mailbox -> cursor && !transfer_next(mailbox)){
+        mailbox -> eof = 1;
+        return 0;
+    }
+    current = mailbox -> current;
+    while(count < max && mailbox -> cursor){
+        mailbox_msg_t* message = &messages[count++];
+        message -> flags = current -> flags;
+        message -> lane = MSG_LANE(current -> flags);
+        message -> send_ns = timing_stamp_ns(current -> send_ns, current -> flags & MSG_TSC);
+        if(current -> flags & MSG_BATCH){
+            //data 中依序是 [2 bytes 長度][內容]，長度超出範圍表示 sender 與 receiver 的格式不一致
+            const unsigned char* header = (const unsigned char*)mailbox -> cursor;
+            size_t size;
+            if(mailbox -> end - mailbox -> cursor < BATCH_HEADER ||
+               (size_t)(mailbox -> end - mailbox -> cursor - BATCH_HEADER) < (size = header[0] | (header[1] << 8))){
+                printf("Malformed message batch\n");
+                exit(1);
+            }
+            message -> data = mailbox -> cursor + BATCH_HEADER;
+            message -> size = size;
+            mailbox -> cursor += BATCH_HEADER + size;
+            if(mailbox -> cursor >= mailbox -> end)
+                mailbox -> cursor = NULL;
+        }
+        else{
+            message -> data = mailbox -> cursor;
+            message -> size = mailbox -> end - mailbox -> cursor;
+            mailbox -> cursor = NULL;
+        }
+        if(mailbox -> first_send_ns == 0)
+            mailbox -> first_send_ns = message -> send_ns;
+        mailbox -> stats.messages++;
+        mailbox -> stats.lane_messages[message -> lane]++;
+        mailbox -> stats.bytes += message -> size;
+    }
+    return count;
+}
+
+int mailbox_recv(mailbox_t* mailbox, mailbox_msg_t* message){
+    return mailbox_recv_batch(mailbox, message, 1);
+}
+
+int mailbox_peek(mailbox_t* mailbox, mailbox_msg_t* message){
+    return mailbox_recv_batch(mailbox, message, 1);
+}
+
+void mailbox_release(mailbox_t* mailbox){
+    if(!mailbox -> cursor) //batch 中還有訊息時 slot 仍在使用
+        transfer_release(mailbox);
+}
+
+size_t mailbox_pending(mailbox_t* mailbox){
+    size_t pending = mailbox -> cursor ? mailbox -> end - mailbox -> cursor : 0;
+    if(mailbox -> transport_ops)
+        pending += transport_buffered(mailbox -> storage.transport);
+    return pending;
+}
+
+void mailbox_stats(mailbox_t* mailbox, mailbox_stats_t* stats){
+    *stats = mailbox -> stats;
+    stats -> poll_idle_ns = mailbox -> poll_stats.idle_ns;
+    stats -> polls = mailbox -> poll_stats.polls;
+    if(mailbox -> credits){
+        stats -> window = atomic_load(&mailbox -> credit_shared -> window);
+        stats -> credit_stalls = atomic_load(&mailbox -> credit_shared -> stalls);
+        stats -> credit_grants = atomic_load(&mailbox -> credit_shared -> grants);
+    }
+}
+
+void mailbox_print_stats(mailbox_t* mailbox, FILE* file){
+    mailbox_stats_t* stats = &mailbox -> stats;
+    if(mailbox -> role == MAILBOX_SENDER && stats -> checksummed){
+        fprintf(file, "Frames: %llu with CRC32C (%s)\n", stats -> checksummed, crc32c_impl());
+    }
+    else if(mailbox -> role == MAILBOX_RECEIVER && (stats -> checksummed || stats -> seq_lost || stats -> seq_reordered)){
+        fprintf(file, "Frames: %llu CRC32C checked (%s), %llu CRC errors, %llu lost, %llu out of order\n",
+                stats -> checksummed, crc32c_impl(), stats -> crc_errors, stats -> seq_lost, stats -> seq_reordered);
+    }
+    if(mailbox -> role == MAILBOX_RECEIVER && mailbox -> conflate)
+        fprintf(file, "Conflated: %llu updates skipped, %llu torn reads retried\n", stats -> conflated, stats -> torn_reads);
+    if(mailbox -> credits){
+        credit_shared_t* shared = mailbox -> credit_shared;
+        fprintf(file, "Credits: window %u (max %u), %lu grants, %lu sender stalls, window grown %lu / shrunk %lu times\n",
+                atomic_load(&shared -> window), mailbox -> credits, atomic_load(&shared -> grants),
+                atomic_load(&shared -> stalls), atomic_load(&shared -> grows), atomic_load(&shared -> shrinks));
+    }
+    if(mailbox -> transport_ops)
+        mailbox -> transport_ops -> stats(mailbox -> storage.transport, file);
+}
+
+//等 sender 建立共享記憶體並 ftruncate 後才 mmap，大小由 sender 決定；placement 為 NULL 時使用一般的 shm
+static void* attach_shm(const char* name, size_t min_size, size_t* size_ptr, const placement_t* placement_ptr){
+    int shm_fd;
+    struct stat st;
+    void* addr;
+    while((shm_fd = placement_ptr ? place_shm_open(placement_ptr, name, O_RDWR, 0666) : shm_open(name, O_RDWR, 0666)) == -1){
+        if(errno != ENOENT){
+            perror("shm_open failed");
+            exit(1);
+        }
+        usleep(1000);
+    }
+    while(1){
+        if(fstat(shm_fd, &st) == -1){
+            perror("fstat failed");
+            exit(1);
+        }
+        if(st.st_size >= (off_t)min_size)
+            break;
+        usleep(1000);
+    }
+    if(placement_ptr)
+        addr = place_mmap(placement_ptr, st.st_size, shm_fd, name);
+    else
+        addr = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if(addr == MAP_FAILED){
+        perror("mmap failed");
+        exit(1);
+    }
+    close(shm_fd);
+    *size_ptr = st.st_size;
+    return addr;
+}
+
+//一般使用者建立 queue 時 mq_maxmsg 的上限，讀不到時使用 Linux 的預設值 10
+static long mq_msg_max(void){
+    long msg_max = 10;
+    FILE* file = fopen("/proc/sys/fs/mqueue/msg_max", "r");
+    if(file){
+        if(fscanf(file, "%ld", &msg_max) != 1 || msg_max < 1)
+            msg_max = 10;
+        fclose(file);
+    }
+    return msg_max;
+}
+
+static void open_queue(mailbox_t* mailbox, unsigned int depth){
+    struct mq_attr attr;
+    //credit window 與 queue 深度是兩件事：window 大於 msg_max 時 queue 只開到 msg_max，滿了之後 mq_send 自然 block
+    long maxmsg = mailbox -> pipelined ? depth : 1;
+    if(mailbox -> credits){
+        maxmsg = mq_msg_max();
+        if(maxmsg > mailbox -> credits)
+            maxmsg = mailbox -> credits;
+    }
+    attr.mq_flags = 0;
+    attr.mq_maxmsg = maxmsg; //佇列最多儲存數量
+    attr.mq_msgsize = sizeof(message_t); //header + data
+    attr.mq_curmsgs = 0; //訊息佇列當前無訊息(後續由系統自動管理)
+
+    mailbox -> storage.mqdes = mq_open(mailbox -> names.queue, O_CREAT | (mailbox -> role == MAILBOX_SENDER ? O_WRONLY : O_RDONLY), 0644, &attr);
+    if(mailbox -> storage.mqdes == (mqd_t)-1){
+        perror("mq_open failed"); //depth 超過 /proc/sys/fs/mqueue/msg_max 時會回傳 EINVAL
+        exit(1);
+    }
+    if(mailbox -> role == MAILBOX_SENDER){
+        if(mq_getattr(mailbox -> storage.mqdes, &attr) == -1){
+            perror("mq_getattr failed");
+            exit(1);
+        }
+        if(attr.mq_maxmsg != maxmsg || attr.mq_msgsize != sizeof(message_t)){ //queue 已存在時 O_CREAT 不會套用新的 attr
+            printf("%s already exists with depth %ld, message size %ld\n", mailbox -> names.queue, attr.mq_maxmsg, attr.mq_msgsize);
+            exit(1);
+        }
+    }
+    if(mailbox -> pipelined)
+        snprintf(mailbox -> description, sizeof(mailbox -> description), "Message Passing (pipelined, depth %u)", depth);
+    else if(mailbox -> credits)
+        snprintf(mailbox -> description, sizeof(mailbox -> description), "Message Passing (credits %u, depth %d)", mailbox -> credits, (int)maxmsg);
+    else
+        snprintf(mailbox -> description, sizeof(mailbox -> description), "Message Passing");
+}
+
+static void open_shm(mailbox_t* mailbox){
+    int shm_fd;
+    shm_fd = shm_open(mailbox -> names.shm, O_CREAT | O_RDWR, 0666); //RDWR:共享記憶體需讀取與寫入
+    if(shm_fd == -1){
+        perror("shm_open failed");
+        exit(1);
+    }
+    //設定共享記憶體大小(message 之後是 busy-poll 的 sequence counter，credit 模式下為 credits 個 slot)
+    mailbox -> shm_size = mailbox -> credits ? mailbox -> credits * ring_slot_size(sizeof(message_t)) : poll_shm_size(sizeof(message_t));
+    if(ftruncate(shm_fd, mailbox -> shm_size) == -1){
+        perror("ftruncate failed");
+        exit(1);
+    }
+    mailbox -> storage.shm_addr = mmap(0, mailbox -> shm_size, PROT_WRITE | PROT_READ, MAP_SHARED, shm_fd, 0); //mmap: 映射共享記憶體區到程式的虛擬地址中
+    if(mailbox -> storage.shm_addr == MAP_FAILED){
+        perror("mmap failed");
+        exit(1);
+    }
+    close(shm_fd);
+    if(mailbox -> credits){
+        snprintf(mailbox -> description, sizeof(mailbox -> description), "Shared Memory (credits, window up to %u)", mailbox -> credits);
+        return;
+    }
+    mailbox -> poll_ptr = poll_seq(mailbox -> storage.shm_addr, sizeof(message_t));
+    snprintf(mailbox -> description, sizeof(mailbox -> description), "Shared Memory");
+}
+
+//priority lanes 時每個 lane 一個 ring，lane i 的 ring 在第 i * ring_bytes 的位置(ring_bytes 為 cache line 的倍數)
+static ring_t* lane_ring(ring_t* first, unsigned int lane){
+    return (ring_t*)((char*)first + lane * ring_bytes(first -> capacity, first -> slot_size));
+}
+
+//conflating 模式：sender 清掉上次留下的 value 後重新建立，receiver 等 sender 初始化完成
+static void open_conflate(mailbox_t* mailbox){
+    mailbox -> shm_size = seqlock_bytes(sizeof(message_t));
+    if(mailbox -> role == MAILBOX_SENDER){
+        int shm_fd;
+        shm_unlink(mailbox -> names.shm); //舊的 value(例如結束訊息)不能被 receiver 當成新的
+        shm_fd = shm_open(mailbox -> names.shm, O_CREAT | O_RDWR, 0666);
+        if(shm_fd == -1){
+            perror("shm_open failed");
+            exit(1);
+        }
+        if(ftruncate(shm_fd, mailbox -> shm_size) == -1){
+            perror("ftruncate failed");
+            exit(1);
+        }
+        mailbox -> storage.seqlock = mmap(0, mailbox -> shm_size, PROT_WRITE | PROT_READ, MAP_SHARED, shm_fd, 0);
+        if(mailbox -> storage.seqlock == MAP_FAILED){
+            perror("mmap failed");
+            exit(1);
+        }
+        close(shm_fd);
+        seqlock_init(mailbox -> storage.seqlock);
+    }
+    else{
+        mailbox -> storage.seqlock = attach_shm(mailbox -> names.shm, mailbox -> shm_size, &mailbox -> shm_size, NULL);
+        while(!atomic_load_explicit(&mailbox -> storage.seqlock -> ready, memory_order_acquire)){
+            usleep(1000);
+        }
+    }
+    snprintf(mailbox -> description, sizeof(mailbox -> description), "Shared Memory (conflating seqlock)");
+}
+
+//ring 放在共用的 /shm_hub 中：以 channel 名稱在 directory 中找到(或建立)自己的 ring
+static void open_hub_channel(mailbox_t* mailbox, const char* channel, unsigned int depth){
+    const char* name = channel ? channel : "default";
+    if(depth & (depth - 1)){
+        printf("Ring depth must be a power of 2\n");
+        exit(1);
+    }
+    if(!hub_mapping)
+        hub_mapping = hub_open(depth ? depth : HUB_SLOTS, sizeof(message_t));
+    hub_refs++;
+    if(depth && depth != hub_mapping -> slots){
+        printf("Channel hub uses %u slots per channel\n", hub_mapping -> slots);
+        exit(1);
+    }
+    if(strlen(name) >= HUB_NAME_MAX){
+        printf("Channel name must be shorter than %d characters\n", HUB_NAME_MAX);
+        exit(1);
+    }
+    mailbox -> hub_id = hub_channel_open(hub_mapping, name);
+    if(mailbox -> hub_id == -1){
+        printf("Channel hub is full (%d channels)\n", HUB_CHANNELS);
+        exit(1);
+    }
+    mailbox -> storage.ring = mailbox -> lane_rings[0] = hub_ring(hub_mapping, mailbox -> hub_id);
+    snprintf(mailbox -> description, sizeof(mailbox -> description), "Ring Buffer (hub channel %d: %.24s)", mailbox -> hub_id, name);
+}
+
+static void hub_leave(mailbox_t* mailbox){
+    if(mailbox -> role == MAILBOX_RECEIVER) //結束訊息已讀到，channel 不會再被使用
+        hub_channel_free(hub_mapping, mailbox -> hub_id);
+    if(--hub_refs == 0){
+        hub_close(hub_mapping);
+        hub_mapping = NULL;
+    }
+}
+
+static void open_ring(mailbox_t* mailbox, unsigned int depth){
+    if(mailbox -> role == MAILBOX_SENDER){
+        int shm_fd;
+        unsigned int slot_size = ring_slot_size(sizeof(message_t));
+        unsigned int slots = depth ? depth : RING_SLOTS;
+        size_t ring_size;
+        if(slots & (slots - 1)){
+            printf("Ring depth must be a power of 2\n");
+            exit(1);
+        }
+        ring_size = place_size(&mailbox -> placement, mailbox -> lanes * ring_bytes(slots, slot_size));
+        place_shm_unlink(&mailbox -> placement, mailbox -> names.ring); //清掉上次異常結束留下的 ring，確保 head/tail 從 0 開始
+        shm_fd = place_shm_open(&mailbox -> placement, mailbox -> names.ring, O_CREAT | O_RDWR, 0666);
+        if(shm_fd == -1){
+            perror("shm_open failed");
+            exit(1);
+        }
+        if(ftruncate(shm_fd, ring_size) == -1){
+            perror("ftruncate failed");
+            exit(1);
+        }
+        mailbox -> storage.ring = place_mmap(&mailbox -> placement, ring_size, shm_fd, mailbox -> names.ring);
+        if(mailbox -> storage.ring == MAP_FAILED){
+            perror("mmap failed");
+            exit(1);
+        }
+        close(shm_fd);
+        for(int lane = mailbox -> lanes - 1; lane >= 0; lane--){ //lane 0 最後初始化，receiver 看到它 ready 時其他 lane 也已就緒
+            ring_t* ring = (ring_t*)((char*)mailbox -> storage.ring + lane * ring_bytes(slots, slot_size));
+            ring_init(ring, slots, slot_size);
+        }
+    }
+    else{
+        size_t ring_size;
+        ring_t* ring = mailbox -> storage.ring = attach_shm(mailbox -> names.ring, sizeof(ring_t), &ring_size, &mailbox -> placement);
+        size_t bytes;
+        while(!atomic_load_explicit(&ring -> ready, memory_order_acquire)){
+            usleep(1000);
+        }
+        //lane 數量與 sender 不同時，多出來的 lane 中的訊息永遠不會被讀到
+        bytes = ring_bytes(ring -> capacity, ring -> slot_size);
+        if(ring_size < mailbox -> lanes * bytes ||
+           (ring_size >= mailbox -> lanes * bytes + sizeof(ring_t) && atomic_load(&lane_ring(ring, mailbox -> lanes) -> ready))){
+            printf("Ring buffer lane count differs from the sender\n");
+            exit(1);
+        }
+    }
+    for(unsigned int lane = 0; lane < mailbox -> lanes; lane++)
+        mailbox -> lane_rings[lane] = lane_ring(mailbox -> storage.ring, lane);
+    snprintf(mailbox -> description, sizeof(mailbox -> description), "Ring Buffer");
+}
+
+static void open_mpmc(mailbox_t* mailbox, unsigned int depth){
+    unsigned int slots = depth ? depth : RING_SLOTS;
+    mpmc_t* queue;
+    if(slots & (slots - 1)){
+        printf("MPMC depth must be a power of 2\n");
+        exit(1);
+    }
+    queue = mailbox -> storage.mpmc = mpmc_open(mailbox -> names.mpmc, slots, sizeof(message_t), &mailbox -> placement); //第一個啟動的 sender / receiver 負責建立
+    if(mailbox -> role == MAILBOX_SENDER){
+        atomic_fetch_add(&queue -> producers, 1);
+        atomic_fetch_add(&queue -> producers_seen, 1);
+        snprintf(mailbox -> description, sizeof(mailbox -> description), "MPMC Queue");
+    }
+    else{
+        mailbox -> consumer_id = atomic_fetch_add(&queue -> consumers_seen, 1);
+        if(mailbox -> consumer_id >= MPMC_MAX_CONSUMERS){
+            printf("At most %d receivers per MPMC queue\n", MPMC_MAX_CONSUMERS);
+            exit(1);
+        }
+        atomic_fetch_add(&queue -> consumers, 1);
+        snprintf(mailbox -> description, sizeof(mailbox -> description), "MPMC Queue (receiver %d)", mailbox -> consumer_id);
+    }
+}
+
+//sender 建立並設定初始值(send 1 或初始的 window、rec 0)，receiver 等 sender 建立後連上
+static void open_handshake(mailbox_t* mailbox, int spins){
+    if(mailbox -> wait == MAILBOX_WAIT_FUTEX){
+        size_t sync_size = sizeof(fsync_t) + (mailbox -> credits ? sizeof(credit_shared_t) : 0);
+        fsem_spin_init(&mailbox -> spin, spins);
+        if(mailbox -> role == MAILBOX_SENDER){
+            int shm_fd;
+            shm_unlink(mailbox -> names.sync); //確保 count 從初始值開始
+            shm_fd = shm_open(mailbox -> names.sync, O_CREAT | O_RDWR, 0666);
+            if(shm_fd == -1){
+                perror("shm_open failed");
+                exit(1);
+            }
+            if(ftruncate(shm_fd, sync_size) == -1){
+                perror("ftruncate failed");
+                exit(1);
+            }
+            mailbox -> sync_ptr = mmap(0, sync_size, PROT_WRITE | PROT_READ, MAP_SHARED, shm_fd, 0);
+            if(mailbox -> sync_ptr == MAP_FAILED){
+                perror("mmap failed");
+                exit(1);
+            }
+            close(shm_fd);
+            mailbox -> sync_size = sync_size;
+            if(mailbox -> credits){
+                mailbox -> credit_shared = (credit_shared_t*)(mailbox -> sync_ptr + 1);
+                atomic_store(&mailbox -> credit_shared -> window, credit_initial(mailbox -> credits));
+            }
+            fsem_init(&mailbox -> sync_ptr -> send_sem, mailbox -> credits ? credit_initial(mailbox -> credits) : 1); //initial = 1
+            fsem_init(&mailbox -> sync_ptr -> rec_sem, 0); //initial = 0
+            atomic_store_explicit(&mailbox -> sync_ptr -> ready, 1, memory_order_release);
+        }
+        else{
+            mailbox -> sync_ptr = attach_shm(mailbox -> names.sync, sync_size, &mailbox -> sync_size, NULL);
+            while(!atomic_load_explicit(&mailbox -> sync_ptr -> ready, memory_order_acquire)){
+                usleep(1000);
+            }
+            if(mailbox -> credits){
+                mailbox -> credit_shared = (credit_shared_t*)(mailbox -> sync_ptr + 1);
+                credit_init(&mailbox -> credit, mailbox -> credit_shared, mailbox -> credits);
+            }
+        }
+    }
+    else if(mailbox -> wait == MAILBOX_WAIT_SEM){
+        int sender = mailbox -> role == MAILBOX_SENDER;
+        mailbox -> send_sem = sem_open(mailbox -> names.send_sem, O_CREAT, 0644, sender ? 1 : 0);
+        mailbox -> rec_sem = sem_open(mailbox -> names.rec_sem, O_CREAT, 0644, 0);
+        if(mailbox -> send_sem == SEM_FAILED || mailbox -> rec_sem == SEM_FAILED){
+            perror("sem_open failed");
+            exit(1);
+        }
+    }
+    //MAILBOX_WAIT_POLL：sequence counter 在 /shm_comm 中，open_shm 時已經設定
+}
+
+mailbox_t* mailbox_open(int role, const char* mechanism, const mailbox_config_t* config){
+    const transport_ops_t* ops = transport_find(mechanism);
+    int flag = ops ? transport_mechanism(ops) : atoi(mechanism);
+    mailbox_t* mailbox;
+    if(flag < 1 || (flag > 4 && !ops))
+        return NULL;
+    mailbox = calloc(1, sizeof(mailbox_t));
+    if(!mailbox){
+        perror("calloc failed");
+        exit(1);
+    }
+    timing_init(); //TSC 校正約需 10 ms，在開始傳送前完成
+    mailbox -> role = role;
+    mailbox -> flag = flag;
+    mailbox -> transport_ops = ops;
+    mailbox -> wait = config -> wait;
+    mailbox -> expected_producers = config -> producers;
+    mailbox -> pipelined = (flag == 1 && config -> depth > 0);
+    mailbox -> credits = config -> credits;
+    mailbox -> lanes = config -> lanes ? config -> lanes : 1;
+    mailbox -> checksum = config -> checksum;
+    mailbox -> conflate = config -> conflate;
+    mailbox -> hub_id = -1;
+    //ring buffer / MPMC 由 slot 數量控制流量、pipelined queue 滿時 mq_send 會 block，transport backend 本身會 block，都不需交握
+    //conflating 模式的 sender 直接覆蓋，永遠不等待 receiver
+    mailbox -> handshake = (flag == 1 && !mailbox -> pipelined) || (flag == 2 && !mailbox -> conflate);
+    mailbox -> arena_fd = -1;
+    ipc_names_init(&mailbox -> names, config -> channel);
+    placement_init(&mailbox -> placement);
+    if(config -> placement && placement_parse(&mailbox -> placement, config -> placement) == -1){
+        printf("Invalid placement %s\n", config -> placement);
+        exit(1);
+    }
+    if(mailbox -> conflate && (flag != 2 || config -> credits || mailbox -> wait == MAILBOX_WAIT_POLL)){
+        printf("Conflating mode requires mechanism 2 without credits or the busy-poll handshake\n");
+        exit(1);
+    }
+    if(config -> hub && (flag != 3 || mailbox -> lanes > 1 || config -> placement)){
+        printf("Channel hub requires mechanism 3 without lanes or placement options\n");
+        exit(1);
+    }
+    if(mailbox -> wait == MAILBOX_WAIT_POLL && flag != 2){
+        printf("Busy-poll handshake requires mechanism 2 (Shared Memory)\n");
+        exit(1);
+    }
+    if(mailbox -> credits && (mailbox -> handshake == 0 || mailbox -> wait != MAILBOX_WAIT_FUTEX)){
+        //ring buffer / MPMC / transport 本身已經以 slot 數量限制在途中的訊息
+        printf("Credit flow control requires mechanism 1 or 2 with the futex handshake and no queue depth\n");
+        exit(1);
+    }
+    if(mailbox -> lanes > MAILBOX_LANES){
+        printf("At most %d priority lanes\n", MAILBOX_LANES);
+        exit(1);
+    }
+    if(mailbox -> lanes > 1 && !((flag == 1 && (mailbox -> pipelined || mailbox -> credits)) || flag == 3)){
+        //一次一則的交握沒有佇列可以插隊；mechanism 2 只有一個 slot(credit 模式下依序輪流)，MPMC 與 transport 只有 FIFO
+        printf("Priority lanes require mechanism 1 with a queue (-q or -C) or mechanism 3\n");
+        exit(1);
+    }
+
+    if(flag == 1)
+        open_queue(mailbox, config -> depth);
+    else if(flag == 2 && mailbox -> conflate)
+        open_conflate(mailbox);
+    else if(flag == 2)
+        open_shm(mailbox);
+    else if(flag == 3 && config -> hub)
+        open_hub_channel(mailbox, config -> channel, config -> depth);
+    else if(flag == 3)
+        open_ring(mailbox, config -> depth);
+    else if(flag == 4)
+        open_mpmc(mailbox, config -> depth);
+    else{
+        mailbox -> storage.transport = transport_open(ops, role == MAILBOX_SENDER ? TRANSPORT_SENDER : TRANSPORT_RECEIVER,
+                                                      &mailbox -> names, sizeof(message_t), config -> depth);
+        snprintf(mailbox -> description, sizeof(mailbox -> description), "Transport: %s", ops -> name);
+    }
+    if(mailbox -> handshake)
+        open_handshake(mailbox, config -> spins);
+    if(mailbox -> lanes > 1){
+        size_t len = strlen(mailbox -> description);
+        snprintf(mailbox -> description + len, sizeof(mailbox -> description) - len, ", %u lanes", mailbox -> lanes);
+    }
+    return mailbox;
+}
+
+//最後離開的 receiver 輸出每個 receiver 分到的負載並移除 queue
+static void mpmc_leave(mailbox_t* mailbox){
+    mpmc_t* queue = mailbox -> storage.mpmc;
+    if(mailbox -> role == MAILBOX_SENDER){
+        //receiver 在所有 sender 離開且佇列清空後結束，最後一個 receiver 負責 shm_unlink
+        atomic_fetch_sub(&queue -> producers, 1);
+    }
+    else{
+        mpmc_consumer_stats_t* stats = &queue -> consumer_stats[mailbox -> consumer_id];
+        stats -> messages = mailbox -> stats.messages;
+        stats -> bytes = mailbox -> stats.bytes;
+        stats -> seconds = mailbox -> stats.messages ? (mailbox -> last_recv_ns - mailbox -> first_send_ns) * 1e-9 : 0;
+        if(atomic_fetch_sub(&queue -> consumers, 1) == 1){
+            int seen = atomic_load(&queue -> consumers_seen);
+            for(int i = 0; i < seen && i < MPMC_MAX_CONSUMERS; i++){
+                stats = &queue -> consumer_stats[i];
+                printf("Consumer %d: %llu messages, %.0f msg/s, %.2f MB/s\n", i, stats -> messages,
+                       stats -> seconds > 0 ? stats -> messages / stats -> seconds : 0,
+                       stats -> seconds > 0 ? stats -> bytes / stats -> seconds / (1 << 20) : 0);
+            }
+            place_shm_unlink(&mailbox -> placement, mailbox -> names.mpmc);
+        }
+    }
+    munmap(queue, place_size(&mailbox -> placement, mpmc_bytes(queue -> capacity, queue -> slot_size)));
+}
+
+void mailbox_close(mailbox_t* mailbox){
+    int sender = mailbox -> role == MAILBOX_SENDER;
+    if(sender)
+        batch_flush(mailbox);
+    else
+        transfer_release(mailbox);
+
+    if(mailbox -> flag == 1){
+        mq_close(mailbox -> storage.mqdes);
+        if(!sender || !(mailbox -> pipelined || mailbox -> credits)) //pipelined / credit 模式下 sender 可能先結束，receiver 還沒讀完，由 receiver 負責 mq_unlink
+            mq_unlink(mailbox -> names.queue);
+    }
+    else if(mailbox -> flag == 2){
+        munmap(mailbox -> storage.shm_addr, mailbox -> shm_size);
+        if(!sender) //輸入為空檔時 receiver 可能還沒 mmap，由 receiver 負責 shm_unlink
+            shm_unlink(mailbox -> names.shm);
+    }
+    else if(mailbox -> flag == 3 && mailbox -> hub_id >= 0){
+        hub_leave(mailbox);
+    }
+    else if(mailbox -> flag == 3){
+        ring_t* ring = mailbox -> storage.ring;
+        munmap(ring, place_size(&mailbox -> placement, mailbox -> lanes * ring_bytes(ring -> capacity, ring -> slot_size)));
+        if(!sender) //sender 可能早已結束，由 receiver 負責移除 ring
+            place_shm_unlink(&mailbox -> placement, mailbox -> names.ring);
+    }
+    else if(mailbox -> flag == 4){
+        mpmc_leave(mailbox);
+    }
+    else{
+        transport_close(mailbox -> storage.transport); //receiver 最後離開，close 時順便移除 fifo / SysV queue / shm
+    }
+
+    if(mailbox -> arena_fd != -1){
+        munmap(mailbox -> arena_addr, mailbox -> arena_size);
+        close(mailbox -> arena_fd);
+        if(sender)
+            place_shm_unlink(&mailbox -> placement, mailbox -> names.arena);
+    }
+    free(mailbox -> large_buf);
+    for(int lane = 0; lane < MAILBOX_LANES; lane++)
+        free(mailbox -> partial[lane].buf);
+
+    if(mailbox -> handshake && mailbox -> wait == MAILBOX_WAIT_FUTEX){
+        munmap(mailbox -> sync_ptr, mailbox -> sync_size);
+        if(!sender) //receiver 結束時才 shm_unlink
+            shm_unlink(mailbox -> names.sync);
+    }
+    else if(mailbox -> handshake && mailbox -> wait == MAILBOX_WAIT_SEM){
+        sem_close(mailbox -> send_sem);
+        sem_close(mailbox -> rec_sem);
+        if(!sender){
+            sem_unlink(mailbox -> names.send_sem);
+            sem_unlink(mailbox -> names.rec_sem);
+        }
+    }
+    free(mailbox);
+}
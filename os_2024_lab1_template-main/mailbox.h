@@ -0,0 +1,152 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*
+ * libmailbox：sender / receiver 共用的 IPC mailbox，也可以直接 link 進其他程式(libmailbox.a / libmailbox.so)。
+ *   mailbox_open        依 mechanism 建立(sender)或連上(receiver)IPC 物件
+ *   mailbox_send        送出一則訊息，超過一個 slot 的訊息自動切成 fragment 或放進 arena
+ *   mailbox_send_lane   同上，但指定 priority lane，receiver 一律先取較高的 lane
+ *   mailbox_send_batch  把多則短訊息打包進同一個 slot(MSG_BATCH)，交握與 commit 的成本由整批分攤
+ *   mailbox_reserve     zero-copy：取得下一個 slot，呼叫者直接把內容寫進 data，再以 mailbox_commit 送出
+ *   mailbox_send_eof    送出結束訊息
+ *   mailbox_recv        取得下一則訊息，batch 會逐則拆開
+ *   mailbox_recv_batch  一次取得同一次傳輸中的所有訊息，只需一次交握
+ *   mailbox_peek        zero-copy：與 mailbox_recv 相同，讀完後可以 mailbox_release 提早把 slot 還給 sender
+ *   mailbox_stats       訊息數、bytes、傳輸次數等統計
+ *   mailbox_close       釋放資源，receiver 負責移除 IPC 物件
+ * recv / peek 回傳的 mailbox_msg_t 直接指向共享記憶體或內部的 buffer，在下一次 recv、release 或 close 之前有效。
+ * 錯誤時印出訊息並結束程式。這個 header 只依賴標準 header，內部的 ring.h、transport.h 等不會外露。
+ */
+#define MSG_DATA_SIZE 1024
+#define MSG_STOP "End" //lab 介面(send / receive)中表示結束的字串；frame 以 MSG_OP_END 表示結束，內容為 "End" 的訊息照常傳送
+#define MSG_MORE 0x1  //同一則訊息還有下一個 fragment
+#define MSG_ARENA 0x2 //payload 放在 arena，size 為整則訊息的長度
+#define MSG_BATCH 0x4 //coalescing：data 中連續放了多則訊息，每則為 [2 bytes 長度(little endian)][內容]，size 為總長度
+#define MSG_CRC 0x8 //crc 欄位為 payload 的 CRC32C(見 crc32c.h)，receiver 依此檢查
+#define MSG_TSC 0x10 //send_ns 為 sender 讀到的 TSC tick(未換算)，receiver 以自己的校正換算成 ns
+#define BATCH_HEADER 2
+#define BATCH_MAX_RECORD (MSG_DATA_SIZE - 1 - BATCH_HEADER) //可以放進 batch 的單則訊息上限
+#define MSG_LANE_SHIFT 8 //flags 的 bit 8 ~ 9 為訊息的 priority lane
+#define MSG_LANE(flags) (((flags) >> MSG_LANE_SHIFT) & (MAILBOX_LANES - 1))
+
+/*
+ * Priority lanes(config.lanes > 1)：lane 0 為一般資料，數字越大越優先，receiver 永遠先取較高 lane 中的訊息，
+ * 控制訊息不會排在大量資料之後。message passing 以 mq 的 priority 實作，ring buffer 每個 lane 各有一個 ring。
+ * 結束訊息代表資料到此為止，走 lane 0 才能排在所有資料之後；同一個 lane 內仍維持送出的順序。
+ */
+#define MAILBOX_LANES 4 //lane 數量上限，必須為 2 的次方
+
+#define MAILBOX_SENDER 0
+#define MAILBOX_RECEIVER 1
+
+#define MAILBOX_WAIT_FUTEX 0 //mechanism 1 (lockstep) / 2 的交握方式
+#define MAILBOX_WAIT_SEM 1
+#define MAILBOX_WAIT_POLL 2
+
+#define MSG_OP_DATA 0
+#define MSG_OP_END 1 //結束訊息，mailbox_send_eof 送出(沒有 payload)、mailbox_recv 看到時回傳 0
+
+/*
+ * 每個 slot / frame 的格式：24 bytes 的 header 之後是 payload，只有有效的 size bytes 會被傳送。
+ * seq 在每個 lane 中逐 frame 遞增(fragment、batch 各算一個)，receiver 以此計算遺失與亂序的 frame。
+ */
+typedef struct {
+    int size; //payload 長度(MSG_ARENA 時為 arena 中整則訊息的長度)
+    unsigned short flags; //MSG_*
+    unsigned char opcode; //MSG_OP_*
+    unsigned char reserved;
+    unsigned int seq;
+    unsigned int crc; //MSG_CRC 時有效
+    long long send_ns; //sender commit 時的時間戳記(MSG_TSC 時為 TSC tick)，receiver 換算成自己的時鐘後計算 one-way latency
+    char data[MSG_DATA_SIZE];
+} message_t;
+
+typedef struct mailbox mailbox_t;
+
+typedef struct {
+    unsigned int depth; //佇列深度，0 為各 mechanism 的預設值(mechanism 1 為一次一則的 lockstep)
+    int wait; //MAILBOX_WAIT_*，雙方必須相同
+    int spins; //futex 睡眠前最多忙等的次數
+    const char* channel; //IPC 物件名稱的後綴，NULL 表示不加；hub 模式下為 channel 名稱
+    const char* placement; //ring / MPMC / arena 的頁面配置(格式見 placement.h)，NULL 為預設
+    int producers; //receiver：MPMC 時要等幾個 sender 連上並結束
+    unsigned int credits; //mechanism 1 / 2 的 credit flow control(見 credit.h)，window 的上限，雙方必須相同；0 為一次一則的交握
+    unsigned int lanes; //priority lane 數量(最多 MAILBOX_LANES)，雙方必須相同；0 或 1 為不分 lane
+    int hub; //mechanism 3 的 ring 放在共用的 /shm_hub 中(見 hub.h)，以 channel 名稱區分，雙方必須相同
+    int conflate; //mechanism 2 的 conflating(latest-value)模式，雙方必須相同：sender 不等待，receiver 只取最新的訊息
+    int checksum; //sender：每個 frame 附上 payload 的 CRC32C，receiver 看到 MSG_CRC 就會檢查，不需設定
+} mailbox_config_t;
+
+typedef struct {
+    const char* data;
+    size_t size;
+    int flags; //原本的 MSG_* flag，從 batch 拆出來的訊息帶 MSG_BATCH
+    int lane;
+    long long send_ns; //已換算成 receiver 的 timing_now_ns()，可以直接與它相減
+} mailbox_msg_t;
+
+typedef struct {
+    unsigned long long messages; //送出 / 收到的訊息數，batch 中每則各算一次，不含結束訊息
+    unsigned long long bytes;
+    unsigned long long transfers; //實際經過 mechanism 的 slot / frame 數
+    unsigned long long batches; //其中 MSG_BATCH 的數量
+    unsigned long long batched; //放在 batch 中的訊息數
+    unsigned long long fragments; //MSG_MORE 的 fragment 數
+    unsigned long long arena; //放進 arena 的訊息數
+    unsigned long long poll_idle_ns; //MAILBOX_WAIT_POLL：忙等的時間與次數
+    unsigned long long polls;
+    unsigned int window; //credit flow control：receiver 目前的 window，未使用時為 0
+    unsigned long long credit_stalls; //sender 用完 credit 而等待的次數
+    unsigned long long credit_grants; //receiver 歸還 credit 的次數
+    unsigned long long lane_messages[MAILBOX_LANES]; //各 lane 的訊息數
+    unsigned long long checksummed; //附有 / 檢查過 CRC32C 的 frame 數
+    unsigned long long crc_errors; //receiver：CRC32C 不符的 frame 數(訊息仍會交給呼叫者)
+    unsigned long long seq_lost; //receiver：seq 跳號而遺失的 frame 數(MPMC 時不檢查)
+    unsigned long long seq_reordered; //receiver：seq 比已收到的還小的 frame 數
+    unsigned long long conflated; //receiver：conflating 模式下被覆蓋而沒有讀到的訊息數
+    unsigned long long torn_reads; //receiver：讀取時 sender 正在寫入而重試的次數
+} mailbox_stats_t;
+
+void mailbox_config_init(mailbox_config_t* config);
+//mechanism 可以是編號("1" ~ "10") 或 transport backend 名稱("fifo")，無法辨識時回傳 NULL
+mailbox_t* mailbox_open(int role, const char* mechanism, const mailbox_config_t* config);
+int mailbox_mechanism(mailbox_t* mailbox);
+const char* mailbox_describe(mailbox_t* mailbox); //例如 "Ring Buffer"、"Transport: fifo"
+
+void mailbox_send(mailbox_t* mailbox, const void* data, size_t size); //lane 0
+void mailbox_send_lane(mailbox_t* mailbox, const void* data, size_t size, int lane);
+void mailbox_send_batch(mailbox_t* mailbox, const struct iovec* messages, int count);
+//逐則加入目前的 batch(lane 0)，滿了才送出；超過 BATCH_MAX_RECORD 的訊息改用 mailbox_send
+void mailbox_batch_add(mailbox_t* mailbox, const void* data, size_t size);
+long long mailbox_batch_started(mailbox_t* mailbox); //目前尚未送出的 batch 開始的時間，沒有時為 0
+void mailbox_flush(mailbox_t* mailbox); //送出未滿的 batch 以及 transport 內部累積的資料
+void mailbox_send_eof(mailbox_t* mailbox);
+
+/*
+ * Zero-copy 傳送：mailbox_reserve 回傳下一個 frame(shared memory / ring buffer 時為共享記憶體中的 slot)，
+ * 呼叫者把最多 MSG_DATA_SIZE - 1 bytes 直接寫進 data，再以 mailbox_commit 交給 receiver，不經過額外的複製。
+ * 兩者之間不能呼叫其他 send 函式；未送出的 batch 會在 reserve 時先送出，訊息一律走 lane 0。
+ */
+message_t* mailbox_reserve(mailbox_t* mailbox);
+void mailbox_commit(mailbox_t* mailbox, message_t* message, size_t size);
+
+//回傳 1；所有 sender 都已結束時回傳 0
+int mailbox_recv(mailbox_t* mailbox, mailbox_msg_t* message);
+//回傳取得的訊息數(最多 max)，所有 sender 都已結束時回傳 0
+int mailbox_recv_batch(mailbox_t* mailbox, mailbox_msg_t* messages, int max);
+//receiver 已收進來但還沒交給呼叫者的 bytes；為 0 時下一次 recv 可能會 block
+size_t mailbox_pending(mailbox_t* mailbox);
+//zero-copy 接收：與 mailbox_recv 相同，data 直接指向 slot
+int mailbox_peek(mailbox_t* mailbox, mailbox_msg_t* message);
+//同一次傳輸的訊息都已取出時把 slot 還給 sender(不必等下一次 recv)；batch 還有訊息時不做事
+void mailbox_release(mailbox_t* mailbox);
+
+void mailbox_stats(mailbox_t* mailbox, mailbox_stats_t* stats);
+void mailbox_print_stats(mailbox_t* mailbox, FILE* file); //credit window 與 transport backend 的統計
+void mailbox_close(mailbox_t* mailbox);
+
+#endif
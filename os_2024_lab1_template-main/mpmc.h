@@ -0,0 +1,190 @@
+#ifndef MPMC_H
+#define MPMC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "ring.h"
+#include "placement.h"
+
+#define MPMC_NAME "/shm_mpmc"
+#define MPMC_MAX_CONSUMERS 64
+
+/*
+ * Bounded multi-producer / multi-consumer queue (Dmitry Vyukov 的做法)。
+ * 每個 slot 前面有一個 sequence number：
+ *   seq == pos          slot 空著，位置 pos 的 producer 可以寫入
+ *   seq == pos + 1      slot 已寫好，位置 pos 的 consumer 可以讀取
+ *   seq == pos + cap    consumer 讀完，留給下一輪 (pos + cap) 的 producer
+ * producer / consumer 之間只靠 CAS 搶 enqueue_pos / dequeue_pos，搶到後各自讀寫自己的 slot，
+ * 誰先有空誰就拿下一則訊息，負載自然平均分給所有 receiver。
+ */
+typedef struct {
+    atomic_ulong seq;
+} mpmc_cell_t;
+
+//每個 receiver 結束時把自己的統計寫進來，最後離開的 receiver 負責印出全部
+typedef struct {
+    unsigned long long messages;
+    unsigned long long bytes;
+    double seconds;
+} mpmc_consumer_stats_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_ulong enqueue_pos;
+    _Alignas(CACHE_LINE) atomic_ulong dequeue_pos;
+    _Alignas(CACHE_LINE) unsigned int capacity;
+    unsigned int slot_size;
+    atomic_int ready;
+    atomic_int producers; //目前還在傳送的 sender 數
+    atomic_int producers_seen; //曾經連上的 sender 數
+    atomic_int consumers; //目前還在接收的 receiver 數
+    atomic_int consumers_seen; //用來分配 receiver 的編號
+    mpmc_consumer_stats_t consumer_stats[MPMC_MAX_CONSUMERS];
+    _Alignas(CACHE_LINE) unsigned char slots[];
+} mpmc_t;
+
+static inline unsigned int mpmc_slot_size(size_t message_size){
+    return ring_slot_size(sizeof(mpmc_cell_t) + message_size);
+}
+
+static inline size_t mpmc_bytes(unsigned int capacity, unsigned int slot_size){
+    return sizeof(mpmc_t) + (size_t)capacity * slot_size;
+}
+
+static inline mpmc_cell_t* mpmc_cell(mpmc_t* queue, unsigned long pos){
+    return (mpmc_cell_t*)(queue -> slots + (size_t)(pos & (queue -> capacity - 1)) * queue -> slot_size);
+}
+
+//payload 緊接在 sequence number 之後
+static inline void* mpmc_payload(mpmc_cell_t* cell){
+    return (char*)cell + sizeof(mpmc_cell_t);
+}
+
+static inline mpmc_cell_t* mpmc_cell_of(void* payload){
+    return (mpmc_cell_t*)((char*)payload - sizeof(mpmc_cell_t));
+}
+
+static inline void mpmc_init(mpmc_t* queue, unsigned int capacity, unsigned int slot_size){
+    queue -> capacity = capacity;
+    queue -> slot_size = slot_size;
+    for(unsigned long i = 0; i < capacity; i++)
+        atomic_store_explicit(&mpmc_cell(queue, i) -> seq, i, memory_order_relaxed);
+    atomic_store_explicit(&queue -> enqueue_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&queue -> dequeue_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&queue -> ready, 1, memory_order_release);
+}
+
+//搶下一個可寫入的 slot，佇列已滿時回傳 NULL
+static inline void* mpmc_try_reserve(mpmc_t* queue){
+    unsigned long pos = atomic_load_explicit(&queue -> enqueue_pos, memory_order_relaxed);
+    while(1){
+        mpmc_cell_t* cell = mpmc_cell(queue, pos);
+        long diff = (long)(atomic_load_explicit(&cell -> seq, memory_order_acquire) - pos);
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&queue -> enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                return mpmc_payload(cell);
+        }
+        else if(diff < 0){
+            return NULL;
+        }
+        else{
+            pos = atomic_load_explicit(&queue -> enqueue_pos, memory_order_relaxed); //被別的 producer 搶走了
+        }
+    }
+}
+
+//slot 仍屬於自己，seq 目前等於 pos，加 1 即交給 consumer
+static inline void mpmc_commit(void* payload){
+    mpmc_cell_t* cell = mpmc_cell_of(payload);
+    unsigned long seq = atomic_load_explicit(&cell -> seq, memory_order_relaxed);
+    atomic_store_explicit(&cell -> seq, seq + 1, memory_order_release);
+}
+
+//搶下一則可讀取的訊息，佇列為空時回傳 NULL
+static inline void* mpmc_try_peek(mpmc_t* queue){
+    unsigned long pos = atomic_load_explicit(&queue -> dequeue_pos, memory_order_relaxed);
+    while(1){
+        mpmc_cell_t* cell = mpmc_cell(queue, pos);
+        long diff = (long)(atomic_load_explicit(&cell -> seq, memory_order_acquire) - (pos + 1));
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&queue -> dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                return mpmc_payload(cell);
+        }
+        else if(diff < 0){
+            return NULL;
+        }
+        else{
+            pos = atomic_load_explicit(&queue -> dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+//seq 目前等於 pos + 1，設為 pos + capacity 讓下一輪的 producer 使用
+static inline void mpmc_release(mpmc_t* queue, void* payload){
+    mpmc_cell_t* cell = mpmc_cell_of(payload);
+    unsigned long seq = atomic_load_explicit(&cell -> seq, memory_order_relaxed);
+    atomic_store_explicit(&cell -> seq, seq - 1 + queue -> capacity, memory_order_release);
+}
+
+/*
+ * sender 與 receiver 都可能先啟動：先到的以 O_EXCL 建立並初始化，
+ * 其他行程等 ready 後直接使用，capacity 以建立者為準。
+ * placement 決定頁面配置(見 placement.h)，各行程 mmap 時各自套用。
+ */
+static inline mpmc_t* mpmc_open(const char* name, unsigned int capacity, size_t message_size, const placement_t* placement){
+    unsigned int slot_size = mpmc_slot_size(message_size);
+    size_t size = place_size(placement, mpmc_bytes(capacity, slot_size));
+    int creator = 1;
+    struct stat st;
+    mpmc_t* queue;
+    int shm_fd = place_shm_open(placement, name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if(shm_fd == -1 && errno == EEXIST){
+        creator = 0;
+        shm_fd = place_shm_open(placement, name, O_RDWR, 0666);
+    }
+    if(shm_fd == -1){
+        perror("shm_open failed");
+        exit(1);
+    }
+    if(creator){
+        if(ftruncate(shm_fd, size) == -1){
+            perror("ftruncate failed");
+            exit(1);
+        }
+    }
+    else{
+        while(1){ //等建立者 ftruncate
+            if(fstat(shm_fd, &st) == -1){
+                perror("fstat failed");
+                exit(1);
+            }
+            if(st.st_size >= (off_t)sizeof(mpmc_t))
+                break;
+            usleep(1000);
+        }
+        size = st.st_size;
+    }
+    queue = place_mmap(placement, size, shm_fd, name);
+    if(queue == MAP_FAILED){
+        perror("mmap failed");
+        exit(1);
+    }
+    close(shm_fd);
+    if(creator){
+        mpmc_init(queue, capacity, slot_size);
+    }
+    else{
+        while(!atomic_load_explicit(&queue -> ready, memory_order_acquire))
+            usleep(1000);
+    }
+    return queue;
+}
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/*
+ * 大型共享記憶體(ring、MPMC、arena)的頁面配置，由 -M 指定，以逗號分隔：
+ *   hugetlb    放在 hugetlbfs 上(取代 /dev/shm)，找不到 hugetlbfs mount 時退回 thp
+ *   thp        madvise(MADV_HUGEPAGE)，/dev/shm 要以 huge=advise(或 always)mount 才會生效
+ *   populate   mmap 後立刻 pre-fault，避免第一輪傳送時才 page fault
+ *   node=N     mbind 到 NUMA node N；node=local 為目前執行的 CPU 所在的 node
+ *   none       全部取消(預設)
+ * hugetlb 會改變 IPC 物件的路徑，sender 與 receiver 必須同時指定；其他選項兩邊各自套用。
+ * 實際生效的結果(page size、huge 映射量、頁面所在 node)在 mmap 後從 /proc/self/smaps 讀出並印到 stderr。
+ */
+#define PLACE_NODE_NONE -1
+#define PLACE_NODE_LOCAL -2
+#define PLACE_MAX_NODES 256
+
+typedef struct {
+    int hugetlb;
+    int thp;
+    int populate;
+    int node;
+    char hugetlbfs[PATH_MAX]; //hugetlbfs 的 mount point，空字串表示使用 /dev/shm
+    size_t huge_page_size;
+} placement_t;
+
+static inline void placement_init(placement_t* placement){
+    memset(placement, 0, sizeof(placement_t));
+    placement -> node = PLACE_NODE_NONE;
+}
+
+static inline int placement_active(const placement_t* placement){
+    return placement -> hugetlb || placement -> thp || placement -> populate || placement -> node != PLACE_NODE_NONE;
+}
+
+//從 /proc/mounts 找第一個 hugetlbfs，page size 取 mount 的 pagesize= 或系統預設的 Hugepagesize
+static inline int placement_find_hugetlbfs(placement_t* placement){
+    char line[PATH_MAX + 256], dir[PATH_MAX], type[64], options[256];
+    char* size_opt;
+    FILE* file = fopen("/proc/mounts", "r");
+    if(!file)
+        return -1;
+    placement -> hugetlbfs[0] = '\0';
+    while(fgets(line, sizeof(line), file)){
+        if(sscanf(line, "%*s %4095s %63s %255s", dir, type, options) != 3 || strcmp(type, "hugetlbfs") != 0)
+            continue;
+        if(access(dir, W_OK) != 0)
+            continue;
+        strcpy(placement -> hugetlbfs, dir);
+        if((size_opt = strstr(options, "pagesize="))){
+            char* end;
+            size_t size = strtoul(size_opt + 9, &end, 10);
+            if(*end == 'G')
+                size <<= 30;
+            else if(*end == 'M')
+                size <<= 20;
+            else if(*end == 'K' || *end == 'k')
+                size <<= 10;
+            placement -> huge_page_size = size;
+        }
+        break;
+    }
+    fclose(file);
+    if(!placement -> hugetlbfs[0])
+        return -1;
+    if(!placement -> huge_page_size){
+        unsigned long kb = 0;
+        file = fopen("/proc/meminfo", "r");
+        while(file && fgets(line, sizeof(line), file)){
+            if(sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+                break;
+        }
+        if(file)
+            fclose(file);
+        placement -> huge_page_size = kb ? kb << 10 : 2 << 20;
+    }
+    return 0;
+}
+
+//解析 -M 的參數，格式錯誤時回傳 -1
+static inline int placement_parse(placement_t* placement, const char* spec){
+    char buf[256];
+    char* token;
+    char* save;
+    if(strlen(spec) >= sizeof(buf))
+        return -1;
+    strcpy(buf, spec);
+    for(token = strtok_r(buf, ",", &save); token; token = strtok_r(NULL, ",", &save)){
+        if(strcmp(token, "none") == 0)
+            placement_init(placement);
+        else if(strcmp(token, "hugetlb") == 0)
+            placement -> hugetlb = 1;
+        else if(strcmp(token, "thp") == 0)
+            placement -> thp = 1;
+        else if(strcmp(token, "populate") == 0)
+            placement -> populate = 1;
+        else if(strcmp(token, "node=local") == 0)
+            placement -> node = PLACE_NODE_LOCAL;
+        else if(strncmp(token, "node=", 5) == 0){
+            char* end;
+            long node = strtol(token + 5, &end, 10);
+            if(*end || end == token + 5 || node < 0 || node >= PLACE_MAX_NODES)
+                return -1;
+            placement -> node = node;
+        }
+        else
+            return -1;
+    }
+    if(placement -> hugetlb && placement_find_hugetlbfs(placement) == -1){
+        fprintf(stderr, "No writable hugetlbfs mount, falling back to transparent huge pages\n");
+        placement -> hugetlb = 0;
+        placement -> thp = 1;
+    }
+    return 0;
+}
+
+//hugetlbfs 上的路徑：shm 名稱去掉開頭的 '/' 後放在 mount point 下，太長時回傳 -1
+static inline int placement_path(const placement_t* placement, const char* name, char* path){
+    if(snprintf(path, PATH_MAX, "%s/%s", placement -> hugetlbfs, name[0] == '/' ? name + 1 : name) >= PATH_MAX){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+//取代 shm_open / shm_unlink：hugetlb 時改用 hugetlbfs 上同名的檔案
+static inline int place_shm_open(const placement_t* placement, const char* name, int flags, mode_t mode){
+    char path[PATH_MAX];
+    if(!placement -> hugetlbfs[0])
+        return shm_open(name, flags, mode);
+    if(placement_path(placement, name, path) == -1)
+        return -1;
+    return open(path, flags, mode);
+}
+
+static inline int place_shm_unlink(const placement_t* placement, const char* name){
+    char path[PATH_MAX];
+    if(!placement -> hugetlbfs[0])
+        return shm_unlink(name);
+    if(placement_path(placement, name, path) == -1)
+        return -1;
+    return unlink(path);
+}
+
+//hugetlbfs 的 ftruncate / mmap / munmap 長度必須是 huge page 的整數倍
+static inline size_t place_size(const placement_t* placement, size_t size){
+    size_t page = placement -> hugetlbfs[0] ? placement -> huge_page_size : 1;
+    return (size + page - 1) / page * page;
+}
+
+static inline int place_current_node(void){
+    unsigned int cpu, node;
+    if(syscall(SYS_getcpu, &cpu, &node, NULL) == -1)
+        return -1;
+    return node;
+}
+
+/*
+ * 設定 MPOL_BIND 並以 MPOL_MF_MOVE 搬移已經存在的頁面。
+ * shm 的 policy 記在共享的物件上，之後其他行程 fault 進來的頁面也會配置在這個 node；
+ * 已經被其他行程映射的頁面需要 MPOL_MF_MOVE_ALL(CAP_SYS_NICE) 才搬得動，所以實際位置另外查詢。
+ */
+static inline int place_bind(void* addr, size_t size, int node){
+    unsigned long mask[PLACE_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, addr, size, MPOL_BIND, mask, PLACE_MAX_NODES, MPOL_MF_MOVE);
+}
+
+//addr 所在頁面實際配置在哪個 node，頁面不存在時會先 fault 進來
+static inline int place_page_node(void* addr){
+    int node;
+    if(syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) == -1)
+        return -1;
+    return node;
+}
+
+//POSIX shm 所在 tmpfs 的 huge= mount option(例如 "never"、"advise")，/dev/shm 上的 THP 由它決定
+static inline const char* place_shm_huge(char* buf, size_t size){
+    char line[PATH_MAX + 256], dir[PATH_MAX], options[256];
+    char *begin, *end;
+    FILE* file = fopen("/proc/mounts", "r");
+    snprintf(buf, size, "unknown");
+    if(!file)
+        return buf;
+    while(fgets(line, sizeof(line), file)){
+        if(sscanf(line, "%*s %4095s %*s %255s", dir, options) != 2 || strcmp(dir, "/dev/shm") != 0)
+            continue;
+        if((begin = strstr(options, "huge="))){
+            begin += 5;
+            if((end = strchr(begin, ',')))
+                *end = '\0';
+            snprintf(buf, size, "%s", begin);
+        }
+        else
+            snprintf(buf, size, "never");
+    }
+    fclose(file);
+    return buf;
+}
+
+//從 /proc/self/smaps 找出從 addr 開始的 mapping，讀出 kernel page size 與以 PMD 映射的 huge page 總量
+static inline void place_smaps(void* addr, unsigned long* page_kb, unsigned long* huge_kb){
+    char line[512];
+    unsigned long start, end, kb;
+    int found = 0;
+    FILE* file = fopen("/proc/self/smaps", "r");
+    *page_kb = 0;
+    *huge_kb = 0;
+    if(!file)
+        return;
+    while(fgets(line, sizeof(line), file)){
+        if(sscanf(line, "%lx-%lx ", &start, &end) == 2 && strchr(line, '-') < strchr(line, ' ')){
+            if(found)
+                break;
+            found = (start == (unsigned long)addr);
+            continue;
+        }
+        if(!found)
+            continue;
+        if(sscanf(line, "KernelPageSize: %lu kB", &kb) == 1)
+            *page_kb = kb;
+        else if(sscanf(line, "ShmemPmdMapped: %lu kB", &kb) == 1 || sscanf(line, "FilePmdMapped: %lu kB", &kb) == 1)
+            *huge_kb += kb;
+    }
+    fclose(file);
+}
+
+/*
+ * 取代 mmap(MAP_SHARED)：先 madvise / mbind 再 pre-fault，頁面才會一開始就以 huge page 配置在指定的 node。
+ * 不直接使用 MAP_POPULATE，因為它在 mmap 當下就 fault，會早於 madvise 與 mbind。
+ * 有要求任何配置時，在 stderr 印出 label 這段記憶體實際的配置(arena 在傳送途中才建立，不能混進 stdout 的訊息輸出)。
+ */
+static inline void* place_mmap(const placement_t* placement, size_t size, int fd, const char* label){
+    int thp = 0, bound = 0, node = placement -> node, populated = 0;
+    unsigned long page_kb, huge_kb;
+    char mode[32];
+    void* addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED || !placement_active(placement))
+        return addr;
+    if(placement -> thp && !placement -> hugetlbfs[0])
+        thp = (madvise(addr, size, MADV_HUGEPAGE) == 0);
+    if(node == PLACE_NODE_LOCAL)
+        node = place_current_node();
+    if(node >= 0)
+        bound = (place_bind(addr, size, node) == 0);
+    if(placement -> populate){
+        populated = 1;
+        if(madvise(addr, size, MADV_POPULATE_WRITE) == -1){ //5.14 以前的 kernel 沒有，改成逐頁讀取
+            size_t offset;
+            for(offset = 0; offset < size; offset += 4096)
+                (void)*(volatile char*)((char*)addr + offset);
+        }
+    }
+
+    place_smaps(addr, &page_kb, &huge_kb);
+    fprintf(stderr, "Placement %s (%zu KiB): %lu KiB pages", label, size >> 10, page_kb);
+    if(placement -> hugetlbfs[0])
+        fprintf(stderr, ", hugetlbfs %s", placement -> hugetlbfs);
+    if(placement -> thp)
+        fprintf(stderr, ", THP %s (/dev/shm huge=%s)", thp ? "advised" : "madvise failed", place_shm_huge(mode, sizeof(mode)));
+    if(populated && placement -> hugetlbfs[0])
+        fprintf(stderr, ", populated");
+    else if(populated) //hugetlbfs 的頁面本來就是 huge page，不會算在 PmdMapped 裡
+        fprintf(stderr, ", populated, %lu KiB huge-mapped", huge_kb);
+    if(placement -> node != PLACE_NODE_NONE){
+        if(bound)
+            fprintf(stderr, ", bound to node %d", node);
+        else
+            fprintf(stderr, ", mbind to node %d failed", node);
+        if(populated)
+            fprintf(stderr, " (pages on node %d)", place_page_node(addr));
+    }
+    fprintf(stderr, "\n");
+    return addr;
+}
+
+#endif
@@ -1,125 +1,203 @@
 #include "receiver.h"
 
-#define QUEUE_NAME "/posix_queue"
-#define SHM_NAME "/shm_comm"
-#define MSG_STOP "End"
+#define RECV_BATCH 64 //一次 mailbox_recv_batch 最多取出的訊息數
+
+static sink_t sink; //-o: 每則訊息的輸出方式
+static latency_hist_t hist; //one-way latency，在 main 結束時輸出
+static latency_hist_t lane_hist[MAILBOX_LANES]; //-l: 各 lane 分開的 latency，控制訊息不會被大量資料的數字蓋過
 
 void receive(message_t* message_ptr, mailbox_t* mailbox_ptr){
-    /*  TODO: 
+    /*  TODO:
         1. Use flag to determine the communication method
         2. According to the communication method, receive the message
     */
-    if(mailbox_ptr -> flag == 1){
-        ssize_t received_bytes = mq_receive(mailbox_ptr -> storage.mqdes, message_ptr -> data, 1024, NULL);
-        if(received_bytes == -1){ //1024: attr.mq_msgsize = 1024, NULL: 忽略優先級
-            perror("mq_send failed");
-            exit(1);
-        }
-        message_ptr -> size = received_bytes;
-        message_ptr -> data[message_ptr -> size] = '\0';
-    }
-    else if(mailbox_ptr -> flag == 2){
-        memcpy(message_ptr, mailbox_ptr -> storage.shm_addr, sizeof(message_t)); //將共享記憶體區的內容複製到message
+    mailbox_msg_t message;
+    size_t size;
+    if(!mailbox_recv(mailbox_ptr, &message)){ //所有 sender 都已結束，和原本的介面一樣以結束訊息表示
+        message.data = MSG_STOP;
+        message.size = strlen(MSG_STOP);
+        message.send_ns = 0;
     }
-    else{
-        printf("Unknown communication mechanism\n");
-        exit(1);
-    } 
+    size = message.size < MSG_DATA_SIZE - 1 ? message.size : MSG_DATA_SIZE - 1; //放不進 message_t 的長訊息只保留開頭
+    message_ptr -> size = size;
+    message_ptr -> flags = 0;
+    message_ptr -> send_ns = message.send_ns;
+    memcpy(message_ptr -> data, message.data, size); //只複製有效的 size bytes
+    message_ptr -> data[size] = '\0';
+}
+
+static void usage(char* program){
+    printf("Usage: %s [-q depth | -C credits | -L] [-w futex|sem|poll] [-s spins] [-c cpu] [-H histogram.csv] [-n channel [-m]] [-P producers] [-l lanes] [-o output] [-M placement] <mechanism>\n", program);
+    printf("mechanism: 1 ~ 4, or 5 ~ 10 / fifo / seqpacket / sysv / eventfd / vmsplice / uring for transport.h backends\n");
+    printf("output: console (default), quiet, or file:PATH for the received messages\n");
+    printf("placement: none or a comma list of hugetlb / thp / populate / node=N / node=local\n");
+    exit(1);
 }
 
 int main(int argc, char* argv[]){
-    /*  TODO: 
+    /*  TODO:
         1) Call receive(&message, &mailbox) according to the flow in slide 4
+            (the loop below uses mailbox_recv_batch() to read messages in place, see mailbox.h)
         2) Measure the total receiving time
         3) Get the mechanism from command line arguments
             • e.g. ./receiver 1
         4) Print information on the console according to the output format
         5) If the exit message is received, print the total receiving time and terminate the receiver.c
     */
-    if(argc < 2){
-        printf("Usage: %s <mechanism>\n", argv[0]); 
-        exit(1);
+    int opt;
+    char* csv_file = NULL; //-H: 結束時把 latency histogram 輸出成 CSV
+    int cpu = -1; //-c: 綁定的 CPU，busy-poll 時應與 sender 分開
+    char* output = NULL; //-o
+    mailbox_config_t config;
+    mailbox_config_init(&config);
+    while((opt = getopt(argc, argv, "q:w:s:H:n:P:c:o:M:C:l:Lm")) != -1){
+        switch(opt){
+            case 'q': //需與 sender 相同，pipelined message passing 的佇列深度
+                if(atoi(optarg) <= 0){
+                    printf("Queue depth must be positive\n");
+                    exit(1);
+                }
+                config.depth = atoi(optarg);
+                break;
+            case 'C': //credit flow control：window 上限，需與 sender 相同
+                if(atoi(optarg) <= 0){
+                    printf("Credit window must be positive\n");
+                    exit(1);
+                }
+                config.credits = atoi(optarg);
+                break;
+            case 'w': //需與 sender 相同
+                if(strcmp(optarg, "futex") == 0)
+                    config.wait = MAILBOX_WAIT_FUTEX;
+                else if(strcmp(optarg, "sem") == 0)
+                    config.wait = MAILBOX_WAIT_SEM;
+                else if(strcmp(optarg, "poll") == 0)
+                    config.wait = MAILBOX_WAIT_POLL;
+                else
+                    usage(argv[0]);
+                break;
+            case 's':
+                config.spins = atoi(optarg);
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'H':
+                csv_file = optarg;
+                break;
+            case 'n': //需與 sender 使用相同的 channel
+                config.channel = optarg;
+                break;
+            case 'P': //MPMC 時要等幾個 sender 連上並結束
+                config.producers = atoi(optarg);
+                if(config.producers <= 0){
+                    printf("Producer count must be positive\n");
+                    exit(1);
+                }
+                break;
+            case 'm': //mechanism 3：ring 放在共用的 channel hub 中，需與對方相同
+                config.hub = 1;
+                break;
+            case 'L': //需與 sender 相同
+                config.conflate = 1;
+                break;
+            case 'l': //需與 sender 相同
+                config.lanes = atoi(optarg);
+                if(config.lanes <= 0 || config.lanes > MAILBOX_LANES){
+                    printf("Lane count must be 1 ~ %d\n", MAILBOX_LANES);
+                    exit(1);
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'M': //含 hugetlb 時需與 sender 相同，node=local 時 ring 會搬到 receiver 所在的 node
+                config.placement = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
     }
+    if(argc - optind < 1)
+        usage(argv[0]);
 
-    int mechanism = atoi(argv[1]);
-    mailbox_t mailbox;
-    mailbox.flag = mechanism;
-
-    sem_t *send_sem = sem_open("/send_sem", O_CREAT, 0644, 0); //initial = 0 //transfer this
-    sem_t *rec_sem = sem_open("/rec_sem", O_CREAT, 0644, 0); //initial = 0 //wait this
-    
-    if(send_sem == SEM_FAILED || rec_sem == SEM_FAILED){
-        perror("sem_open failed");
+    if(sink_open(&sink, output) == -1)
+        usage(argv[0]);
+    if(cpu >= 0)
+        pin_cpu(cpu);
+    mailbox_t* mailbox = mailbox_open(MAILBOX_RECEIVER, argv[optind], &config);
+    if(!mailbox){
+        printf("Unknown communication mechanism\n");
         exit(1);
     }
-    
-    if(mechanism == 1){
-        struct mq_attr attr;
-        attr.mq_flags = 0;
-        attr.mq_maxmsg = 1; //佇列最多儲存數量
-        attr.mq_msgsize = 1024;
-        attr.mq_curmsgs = 0; //訊息佇列當前無訊息(後續由系統自動管理)
+    printf("\e[1;36m%s\e[m\n", mailbox_describe(mailbox));
 
-        mailbox.storage.mqdes = mq_open(QUEUE_NAME, O_CREAT | O_RDONLY, 0644, &attr); //WRONLY:只寫入
-        if(mailbox.storage.mqdes == (mqd_t)-1){
-            perror("mq_open failed");
-            exit(1);
-        }
-        
-        printf("\e[1;36mMessage Passing\e[m\n");
-    }
-    else if(mechanism == 2){
-        int shm_fd;
-        shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666); //RDWR:共享記憶體需讀取與寫入
-        if(shm_fd == -1){
-            perror("shm_open failed");
-            exit(1);
-        }
-        if(ftruncate(shm_fd, sizeof(message_t)) == -1){//設定共享記憶體大小
-            perror("ftruncate failed");
-            exit(1);
-        } 
-        
-        mailbox.storage.shm_addr = mmap(0, sizeof(message_t), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0); //mmap: 映射共享記憶體區到程式的虛擬地址中
-        if(mailbox.storage.shm_addr == MAP_FAILED){
-            perror("mmap failed");
-            exit(1);
-        }
-        printf("\e[1;36mShared Memory\e[m\n");
-    }
-
-    message_t message;
-    struct timespec start, end;
+    mailbox_msg_t messages[RECV_BATCH];
+    int count;
+    long long start, recv_ns;
+    long long first_send_ns = 0, last_recv_ns = 0;
     double time_taken = 0.0;
+    //mechanism uring 且輸出到 console：輸出也以 io_uring 批次寫到 stdout，一個 64 KiB buffer 才一次提交
+    uring_writer_t uring_out;
+    int uring_output = sink.mode == SINK_CONSOLE && mailbox_mechanism(mailbox) == transport_mechanism(transport_find("uring"));
+    static const char receiving[] = "\e[1;36mReceiving message: \e[m ";
+    if(uring_output){
+        fflush(stdout); //之前 printf 的內容要先寫出，順序才不會亂
+        uring_writer_init(&uring_out, STDOUT_FILENO, config.depth ? config.depth : URING_DEPTH, URING_BUF_SIZE);
+    }
 
     while(1){
-        sem_wait(rec_sem);
-        clock_gettime(CLOCK_MONOTONIC, &start);
-        receive(&message, &mailbox);
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        
-        if(strcmp(message.data, MSG_STOP) == 0){
+        start = now_ns();
+        count = mailbox_recv_batch(mailbox, messages, RECV_BATCH); //直接指向共享記憶體中的 slot，不複製
+        recv_ns = now_ns();
+        if(count == 0) //收到結束訊息，MPMC 時為所有 sender 都已結束
             break;
+        //coalescing 的 batch 已由 libmailbox 逐則拆開，和一般訊息一樣各自輸出與記錄 latency
+        for(int i = 0; i < count; i++){
+            if(uring_output){
+                uring_writer_write(&uring_out, receiving, sizeof(receiving) - 1);
+                uring_writer_write(&uring_out, messages[i].data, messages[i].size);
+            }
+            else{
+                sink_message(&sink, receiving, messages[i].data, messages[i].size);
+            }
+            lat_record(&hist, recv_ns - messages[i].send_ns, messages[i].size);
+            if(config.lanes > 1)
+                lat_record(&lane_hist[messages[i].lane], recv_ns - messages[i].send_ns, messages[i].size);
         }
-
-        printf("\e[1;36mReceiving message: \e[m %s", message.data); 
-        time_taken += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
-        sem_post(send_sem);
+        if(uring_output && mailbox_pending(mailbox) == 0) //下一則要等 sender，先把輸出送出去
+            uring_writer_flush(&uring_out);
+        //第一次 mailbox_recv_batch 包含等 sender 啟動的時間，不計入(與原本在 sem_wait 之後才開始計時相同)
+        if(first_send_ns == 0)
+            first_send_ns = messages[0].send_ns;
+        else
+            time_taken += (recv_ns - start) * 1e-9;
+        last_recv_ns = recv_ns;
     }
 
-    if(mechanism == 1){
-        mq_close(mailbox.storage.mqdes);
-        mq_unlink(QUEUE_NAME);
-    }
-    else if(mechanism == 2){
-        munmap(mailbox.storage.shm_addr, sizeof(message_t));
-    }
+    mailbox_stats_t stats;
+    mailbox_stats(mailbox, &stats);
+    if(uring_output)
+        uring_writer_close(&uring_out); //io_uring 的輸出寫完才印結束訊息，順序才不會亂
     printf("\e[1;31\nmSender exit!\e[m\n");
+    if(uring_output)
+        printf("Output via io_uring: %llu syscalls\n", uring_writer_syscalls(&uring_out));
+    sink_close(&sink);
     printf("Total time taken in receiving msg: %f s\n", time_taken);
-    memset(&message, 0, sizeof(message_t));
-    sem_close(send_sem);
-    sem_close(rec_sem);
-    sem_unlink("/send_sem");
-    sem_unlink("/rec_sem");
+    sink_print(&sink);
+    if(stats.batches)
+        printf("Unpacked %llu coalesced batches\n", stats.batches);
+    if(config.wait == MAILBOX_WAIT_POLL){
+        poll_stats_t poll_stats = {stats.poll_idle_ns, stats.polls};
+        poll_print(&poll_stats, cpu);
+    }
+    mailbox_print_stats(mailbox, stdout);
+    timing_print(stdout);
+    lat_print(&hist, (last_recv_ns - first_send_ns) * 1e-9); //從第一則送出到最後一則收到
+    for(unsigned int lane = 0; config.lanes > 1 && lane < config.lanes; lane++)
+        lat_print_lane(&lane_hist[lane], lane);
+    if(csv_file && lat_dump_csv(&hist, csv_file) == -1)
+        perror("histogram csv");
+    mailbox_close(mailbox); //MPMC 時最後離開的 receiver 輸出每個 receiver 分到的負載
     return 0;
 }
@@ -1,35 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
-#include <sys/shm.h>
-#include <semaphore.h>
 #include <time.h>
-#include <mqueue.h>
-#include <sys/mman.h>
-
-typedef struct {
-    int flag;      // 1 for message passing, 2 for shared memory
-    union{
-        //int msqid; //for system V api. You can replace it with struecture for POSIX api
-        mqd_t mqdes;
-        char* shm_addr;
-    }storage;
-} mailbox_t;
-
-
-typedef struct {
-    /*  TODO: 
-        Message structure for wrapper
-    */
-    int size;
-    char data[1024];
-} message_t;
+#include "mailbox.h"
+#include "futex_sync.h"
+#include "latency.h"
+#include "transport.h"
+#include "uring.h"
+#include "sink.h"
 
+/*
+ * mailbox_t、message_t 與 IPC mechanism 的實作在 libmailbox(mailbox.h / mailbox.c)，
+ * 這裡只保留 lab 規定的 receive() 介面。
+ */
 void receive(message_t* message_ptr, mailbox_t* mailbox_ptr);
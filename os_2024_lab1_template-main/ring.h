@@ -0,0 +1,106 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+
+#define RING_NAME "/shm_ring"
+#define CACHE_LINE 64
+#define RING_SLOTS 256 //slot 數量，必須為 2 的次方(index 以 & (capacity - 1) 取餘)
+#define RING_SPIN_LIMIT 1024 //忙等超過此次數後改用 sched_yield 讓出 CPU
+
+/*
+ * Single-producer / single-consumer ring buffer，放在共享記憶體中。
+ * head 只由 sender 寫入、tail 只由 receiver 寫入，兩者放在不同的 cache line
+ * 避免 false sharing；head/tail 為不斷遞增的計數器，head - tail 即為目前佇列中的訊息數。
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_uint head; //producer 下一個要寫入的位置
+    unsigned int cached_tail; //producer 上次看到的 tail，減少讀取對方 cache line 的次數
+    _Alignas(CACHE_LINE) atomic_uint tail; //consumer 下一個要讀取的位置
+    unsigned int cached_head; //consumer 上次看到的 head
+    _Alignas(CACHE_LINE) unsigned int capacity;
+    unsigned int slot_size; //每個 slot 的大小(已對齊 cache line)
+    atomic_int ready; //sender 初始化完成後設為 1
+    _Alignas(CACHE_LINE) unsigned char slots[];
+} ring_t;
+
+static inline void ring_cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+//先短暫忙等，超過 RING_SPIN_LIMIT 次後讓出 CPU(單核心時對方才有機會執行)
+static inline void ring_backoff(unsigned int* spins){
+    if(++*spins < RING_SPIN_LIMIT){
+        ring_cpu_relax();
+    }
+    else{
+        sched_yield();
+    }
+}
+
+static inline unsigned int ring_slot_size(size_t message_size){
+    return (message_size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+}
+
+static inline size_t ring_bytes(unsigned int capacity, unsigned int slot_size){
+    return sizeof(ring_t) + (size_t)capacity * slot_size;
+}
+
+static inline void ring_init(ring_t* ring, unsigned int capacity, unsigned int slot_size){
+    atomic_store_explicit(&ring -> head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring -> tail, 0, memory_order_relaxed);
+    ring -> cached_tail = 0;
+    ring -> cached_head = 0;
+    ring -> capacity = capacity;
+    ring -> slot_size = slot_size;
+    atomic_store_explicit(&ring -> ready, 1, memory_order_release); //最後才設 ready，receiver 看到時其他欄位已就緒
+}
+
+static inline void* ring_slot(ring_t* ring, unsigned int index){
+    return ring -> slots + (size_t)(index & (ring -> capacity - 1)) * ring -> slot_size;
+}
+
+//取得下一個可寫入的 slot，佇列已滿時回傳 NULL
+static inline void* ring_try_reserve(ring_t* ring){
+    unsigned int head = atomic_load_explicit(&ring -> head, memory_order_relaxed);
+    if(head - ring -> cached_tail == ring -> capacity){
+        ring -> cached_tail = atomic_load_explicit(&ring -> tail, memory_order_acquire);
+        if(head - ring -> cached_tail == ring -> capacity){
+            return NULL;
+        }
+    }
+    return ring_slot(ring, head);
+}
+
+//寫完 slot 後才推進 head(release)，receiver 讀到新的 head 時一定看得到 slot 內容
+static inline void ring_commit(ring_t* ring){
+    unsigned int head = atomic_load_explicit(&ring -> head, memory_order_relaxed);
+    atomic_store_explicit(&ring -> head, head + 1, memory_order_release);
+}
+
+//取得下一個可讀取的 slot，佇列為空時回傳 NULL
+static inline void* ring_try_peek(ring_t* ring){
+    unsigned int tail = atomic_load_explicit(&ring -> tail, memory_order_relaxed);
+    if(tail == ring -> cached_head){
+        ring -> cached_head = atomic_load_explicit(&ring -> head, memory_order_acquire);
+        if(tail == ring -> cached_head){
+            return NULL;
+        }
+    }
+    return ring_slot(ring, tail);
+}
+
+//讀完 slot 後推進 tail，把 slot 還給 sender
+static inline void ring_release(ring_t* ring){
+    unsigned int tail = atomic_load_explicit(&ring -> tail, memory_order_relaxed);
+    atomic_store_explicit(&ring -> tail, tail + 1, memory_order_release);
+}
+
+#endif
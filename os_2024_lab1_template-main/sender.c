@@ -1,138 +1,344 @@
 #include "sender.h"
+#include <errno.h>
+#include <sys/select.h>
 
-#define QUEUE_NAME "/posix_queue"
-#define SHM_NAME "/shm_comm"
-#define MSG_STOP "End"
+static sink_t sink; //-o: 每則訊息的輸出方式
+static const char sending[] = "\e[1;36mSending message: \e[m";
 
 void send(message_t message, mailbox_t* mailbox_ptr){
-    /*  TODO: 
+    /*  TODO:
         1. Use flag to determine the communication method
         2. According to the communication method, send the message
     */
-    if(mailbox_ptr -> flag == 1){
-        //msgsnd： 將 message 發送到mailbox_ptr -> storage.msqid 的佇列中
-        //不計mtype大小，僅從data[]開始計算，，所以減去sizeof(long)
-        if(mq_send(mailbox_ptr -> storage.mqdes, message.data, message.size, 0) == -1){
-            perror("mq_send failed");
-            exit(1);
-        }
+    //mechanism 的選擇與交握都在 libmailbox 中，結束訊息另外以 mailbox_send_eof 送出(會先送出未滿的 batch)
+    if((size_t)message.size == strlen(MSG_STOP) && memcmp(message.data, MSG_STOP, message.size) == 0)
+        mailbox_send_eof(mailbox_ptr);
+    else
+        mailbox_send(mailbox_ptr, message.data, message.size); //只複製有效的 size bytes，不複製整個 message_t
+}
+
+static double time_taken = 0.0;
+
+/*
+ * Coalescing(-b usec)：連續的短行交給 mailbox_batch_add 打包進同一個 slot(MSG_BATCH)。
+ * batch 滿了、batch 中最舊的一行已經等了 usec 微秒，或是輸入即將 block 時送出(usec 為 0 時不計時)。
+ */
+static long coalesce_us = -1; //-1 表示不打包
+
+//-u prefix：以 prefix 開頭的行(例如 heartbeat、控制指令)送到最高的 lane，不排在一般資料之後
+static const char* urgent_prefix = NULL;
+static int urgent_lane = 0;
+
+//mailbox 可能因為對方太慢而等待，計入傳送時間；輸出 "Sending message" 與原本一樣在計時之後，不計入
+static void send_line(const char* line, size_t len, mailbox_t* mailbox_ptr){
+    long long start = now_ns();
+    if(urgent_prefix && len >= strlen(urgent_prefix) && memcmp(line, urgent_prefix, strlen(urgent_prefix)) == 0){
+        mailbox_send_lane(mailbox_ptr, line, len, urgent_lane);
     }
-    else if(mailbox_ptr -> flag == 2){
-        memcpy(mailbox_ptr -> storage.shm_addr, &message, sizeof(message_t)); //將message的內容複製到共享記憶體區
+    else if(coalesce_us >= 0 && len <= BATCH_MAX_RECORD){
+        long long batch_start_ns;
+        mailbox_batch_add(mailbox_ptr, line, len);
+        batch_start_ns = mailbox_batch_started(mailbox_ptr);
+        if(coalesce_us > 0 && batch_start_ns && now_ns() - batch_start_ns >= coalesce_us * 1000LL)
+            mailbox_flush(mailbox_ptr);
     }
     else{
-        printf("Unknown communication mechanism\n");
+        mailbox_send(mailbox_ptr, line, len);
+    }
+    time_taken += (now_ns() - start) * 1e-9;
+    sink_message(&sink, sending, line, len);
+}
+
+//mmap 版本：用 scan_newline 找行尾，每一行以 (指標, 長度) 交給 mailbox，不經過 stdio buffer
+static void send_mapped(const char* map, size_t size, mailbox_t* mailbox_ptr){
+    const char* p = map;
+    const char* end = map + size;
+    while(p < end){
+        const char* newline = scan_newline(p, end);
+        const char* next = newline < end ? newline + 1 : end; //最後一行可能沒有換行
+        send_line(p, next - p, mailbox_ptr);
+        p = next;
+    }
+}
+
+/*
+ * io_uring 版本(mechanism uring 且輸入為 pipe / stdin 時)：以 uring_reader 讀取，
+ * 處理目前這段資料時下一段的 read 已經在 kernel 中進行。跨越兩段的行先接在 carry 中。
+ * 下一段還沒讀到時先 flush，互動輸入的訊息不會一直留在 batch buffer 裡。
+ */
+static void send_uring(int fd, mailbox_t* mailbox_ptr){
+    uring_reader_t reader;
+    char* carry = NULL;
+    size_t carry_len = 0, carry_cap = 0;
+    char* chunk;
+    size_t len;
+    uring_reader_init(&reader, fd, URING_BUF_SIZE);
+    while(1){
+        if(!uring_reader_ready(&reader))
+            mailbox_flush(mailbox_ptr);
+        if((len = uring_reader_next(&reader, &chunk)) == 0)
+            break;
+        const char* p = chunk;
+        const char* end = chunk + len;
+        while(p < end){
+            const char* newline = scan_newline(p, end);
+            const char* next = newline < end ? newline + 1 : end;
+            if(carry_len + (next - p) > carry_cap && (newline == end || carry_len > 0)){
+                carry_cap = (carry_len + (next - p)) * 2;
+                carry = realloc(carry, carry_cap);
+                if(!carry){
+                    perror("realloc failed");
+                    exit(1);
+                }
+            }
+            if(newline == end){ //這一行在下一段才結束
+                memcpy(carry + carry_len, p, next - p);
+                carry_len += next - p;
+            }
+            else if(carry_len > 0){
+                memcpy(carry + carry_len, p, next - p);
+                send_line(carry, carry_len + (next - p), mailbox_ptr);
+                carry_len = 0;
+            }
+            else{
+                send_line(p, next - p, mailbox_ptr);
+            }
+            p = next;
+        }
+    }
+    if(carry_len > 0) //最後一行沒有換行
+        send_line(carry, carry_len, mailbox_ptr);
+    free(carry);
+    uring_reader_close(&reader);
+}
+
+/*
+ * pipe / stdin 或無法 mmap 時的版本：自己 read() 並用 scan_newline 切行，長行不受 MSG_DATA_SIZE 限制。
+ * 有未送出的 batch 時先以 select() 等輸入，超過 batch 的剩餘時間(usec 為 0 時不等)就先送出 batch，
+ * 互動輸入的訊息不會因為等不到下一行而一直留在 batch 裡。
+ */
+static void send_fd(int fd, mailbox_t* mailbox_ptr){
+    size_t cap = 1 << 16, len = 0;
+    char* buf = malloc(cap);
+    if(!buf){
+        perror("malloc failed");
         exit(1);
-    } 
+    }
+    while(1){
+        ssize_t n;
+        long long batch_start_ns = mailbox_batch_started(mailbox_ptr);
+        if(len == cap){ //單行比 buffer 還長
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if(!buf){
+                perror("realloc failed");
+                exit(1);
+            }
+        }
+        if(batch_start_ns){
+            long long left_ns = coalesce_us * 1000LL - (now_ns() - batch_start_ns);
+            struct timeval timeout = {0, 0};
+            fd_set readable;
+            if(coalesce_us > 0 && left_ns > 0){
+                timeout.tv_sec = left_ns / 1000000000LL;
+                timeout.tv_usec = left_ns % 1000000000LL / 1000;
+            }
+            FD_ZERO(&readable);
+            FD_SET(fd, &readable);
+            if(select(fd + 1, &readable, NULL, NULL, &timeout) == 0)
+                mailbox_flush(mailbox_ptr);
+        }
+        n = read(fd, buf + len, cap - len);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n == -1){
+            perror("read failed");
+            exit(1);
+        }
+        if(n == 0)
+            break;
+        len += n;
+        const char* p = buf;
+        const char* end = buf + len;
+        const char* newline;
+        while((newline = scan_newline(p, end)) < end){
+            send_line(p, newline + 1 - p, mailbox_ptr);
+            p = newline + 1;
+        }
+        len = end - p;
+        memmove(buf, p, len); //不完整的最後一行留到下一次 read
+    }
+    if(len > 0) //最後一行沒有換行
+        send_line(buf, len, mailbox_ptr);
+    free(buf);
+}
+
+static void usage(char* program){
+    printf("Usage: %s [-q depth | -C credits | -L] [-w futex|sem|poll] [-s spins] [-c cpu] [-b usec] [-l lanes [-u prefix]] [-k] [-o output] [-M placement] [-n channel [-m]] <mechanism> <input file | ->\n", program);
+    printf("output: console (default), quiet, or file:PATH for the sent lines\n");
+    printf("placement: none or a comma list of hugetlb / thp / populate / node=N / node=local\n");
+    exit(1);
 }
 
 int main(int argc, char* argv[]){
-    /*  TODO: 
+    /*  TODO:
         1) Call send(message, &mailbox) according to the flow in slide 4
+            (the loops below hand each line to libmailbox as a (pointer, length) view, see mailbox.h)
         2) Measure the total sending time
         3) Get the mechanism and the input file from command line arguments
             • e.g. ./sender 1 input.txt
-                    (1 for Message Passing, 2 for Shared Memory)
+                    (1 for Message Passing, 2 for Shared Memory, 3 for Ring Buffer, 4 for MPMC Queue,
+                     5 ~ 10 or fifo / seqpacket / sysv / eventfd / vmsplice / uring for transport.h backends)
         4) Get the messages to be sent from the input file
         5) Print information on the console according to the output format
         6) If the message form the input file is EOF, send an exit message to the receiver.c
         7) Print the total sending time and terminate the sender.c
     */
-    if(argc < 3){ //0: program name, 1: mechanism flag, 2: input file name
-        printf("Usage: %s <mechanism> <input file>\n", argv[0]); 
-        exit(1);
+    int opt;
+    int cpu = -1; //-c: 綁定的 CPU
+    char* output = NULL; //-o
+    mailbox_config_t config;
+    mailbox_config_init(&config);
+    while((opt = getopt(argc, argv, "q:w:s:n:c:b:o:M:C:l:u:kLm")) != -1){
+        switch(opt){
+            case 'q': //佇列深度，預設 message passing 一次一則並交握
+                if(atoi(optarg) <= 0){
+                    printf("Queue depth must be positive\n");
+                    exit(1);
+                }
+                config.depth = atoi(optarg);
+                break;
+            case 'C': //credit flow control 的 window 上限，取代 -q 與一次一則的交握
+                if(atoi(optarg) <= 0){
+                    printf("Credit window must be positive\n");
+                    exit(1);
+                }
+                config.credits = atoi(optarg);
+                break;
+            case 'w': //handshake 使用的同步方式
+                if(strcmp(optarg, "futex") == 0)
+                    config.wait = MAILBOX_WAIT_FUTEX;
+                else if(strcmp(optarg, "sem") == 0)
+                    config.wait = MAILBOX_WAIT_SEM;
+                else if(strcmp(optarg, "poll") == 0) //忙等 /shm_comm 中的 sequence counter
+                    config.wait = MAILBOX_WAIT_POLL;
+                else
+                    usage(argv[0]);
+                break;
+            case 's': //futex 模式睡眠前最多忙等的次數
+                config.spins = atoi(optarg);
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'n': //同一台機器上同時跑多組時用來區分
+                config.channel = optarg;
+                break;
+            case 'b': //coalescing：把連續的短行打包送出，batch 最多等 usec 微秒
+                coalesce_us = atol(optarg);
+                if(coalesce_us < 0){
+                    printf("Coalescing timer must not be negative\n");
+                    exit(1);
+                }
+                break;
+            case 'l': //priority lane 數量，需與 receiver 相同
+                config.lanes = atoi(optarg);
+                if(config.lanes <= 0 || config.lanes > MAILBOX_LANES){
+                    printf("Lane count must be 1 ~ %d\n", MAILBOX_LANES);
+                    exit(1);
+                }
+                break;
+            case 'u':
+                urgent_prefix = optarg;
+                break;
+            case 'm': //mechanism 3：ring 放在共用的 channel hub 中，需與對方相同
+                config.hub = 1;
+                break;
+            case 'L': //mechanism 2 的 conflating 模式：不等 receiver，只保證最新的訊息會被讀到
+                config.conflate = 1;
+                break;
+            case 'k': //每個 frame 附上 CRC32C，receiver 自動檢查
+                config.checksum = 1;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'M': //ring、MPMC 與 arena 的頁面配置
+                config.placement = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
     }
+    if(argc - optind < 2) //mechanism flag, input file name
+        usage(argv[0]);
 
-    int mechanism = atoi(argv[1]);
-    char* input_file = argv[2];
-    
-    mailbox_t mailbox;
-    mailbox.flag = mechanism;
-    
-    sem_t *send_sem = sem_open("/send_sem", O_CREAT, 0644, 1); //initial = 1
-    sem_t *rec_sem = sem_open("/rec_sem", O_CREAT, 0644, 0); //initial = 0
-    //創資源
-    if(send_sem == SEM_FAILED || rec_sem == SEM_FAILED){
-        perror("sem_open failed");
+    char* input_file = argv[optind + 1];
+    if(urgent_prefix && config.lanes < 2){
+        printf("-u requires at least 2 lanes (-l)\n");
         exit(1);
     }
-    if(mechanism == 1){
-        struct mq_attr attr;
-        attr.mq_flags = 0;
-        attr.mq_maxmsg = 1; //佇列最多儲存數量
-        attr.mq_msgsize = 1024;
-        attr.mq_curmsgs = 0; //訊息佇列當前無訊息(後續由系統自動管理)
-        
-        mailbox.storage.mqdes = mq_open(QUEUE_NAME, O_CREAT | O_WRONLY, 0644, &attr); //WRONLY:只寫入
-        if(mailbox.storage.mqdes == (mqd_t)-1){
-            perror("mq_open failed");
-            exit(1);
-        }
-        
-        printf("\e[1;36mMessage Passing\e[m\n");
-    }
-    else if(mechanism == 2){
-        int shm_fd;
-        shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666); //RDWR:共享記憶體需讀取與寫入
-        if(shm_fd == -1){
-            perror("shm_open failed");
-            exit(1);
-        }
+    urgent_lane = config.lanes - 1;
+    if(sink_open(&sink, output) == -1)
+        usage(argv[0]);
+    if(cpu >= 0)
+        pin_cpu(cpu);
 
-        
-        if(ftruncate(shm_fd, sizeof(message_t)) == -1){//設定共享記憶體大小
-            perror("ftruncate failed");
-            exit(1);
-        } 
-        mailbox.storage.shm_addr = mmap(0, sizeof(message_t), PROT_WRITE | PROT_READ, MAP_SHARED, shm_fd, 0); //mmap: 映射共享記憶體區到程式的虛擬地址中
-        if(mailbox.storage.shm_addr == MAP_FAILED){
-            perror("mmap failed");
-            exit(1);
-        }
-        printf("\e[1;36mShared Memory\e[m\n");
+    mailbox_t* mailbox = mailbox_open(MAILBOX_SENDER, argv[optind], &config); //mechanism 5 ~ 10 也可以用名稱指定
+    if(!mailbox){
+        printf("Unknown communication mechanism\n");
+        exit(1);
     }
-    
-    FILE* file = fopen(input_file, "r");
-    if(!file){
-        perror("fopen failed");
+    printf("\e[1;36m%s\e[m\n", mailbox_describe(mailbox));
+
+    int fd = strcmp(input_file, "-") == 0 ? STDIN_FILENO : open(input_file, O_RDONLY);
+    if(fd == -1){
+        perror("open failed");
         exit(1);
     }
 
-    message_t message;
-    char buffer[1024];
-    struct timespec start, end;
-    double time_taken = 0.0;
-    while(fgets(buffer, 1024, file)){ //一次讀一行
-        sem_wait(send_sem); //waiting receiver's transmit //send_sem--;
-        message.size = strlen(buffer);
-        strncpy(message.data, buffer, sizeof(message.data) - 1);
-        message.data[sizeof(message.data) - 1] = '\0';
-        clock_gettime(CLOCK_MONOTONIC, &start);
-        send(message, &mailbox);
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        printf("\e[1;36mSending message: \e[m%s", message.data);    
-        
-        time_taken += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
-        sem_post(rec_sem); //transfer to receiver //rec_sem++
-    }
-    fclose(file);
-    sem_wait(send_sem); //waiting receiver's transmit
-    strncpy(message.data, MSG_STOP, 1024);
-    message.size = strlen(message.data);
-    send(message, &mailbox);
-    sem_post(rec_sem); //transfer to receiver
-    if(mechanism == 1){
-        mq_close(mailbox.storage.mqdes);
-        mq_unlink(QUEUE_NAME);
-    }
-    else if(mechanism == 2){
-        munmap(mailbox.storage.shm_addr, sizeof(message_t));
-        shm_unlink(SHM_NAME);
-    }
-    memset(&message, 0, sizeof(message_t));
+    struct stat st;
+    char* map = MAP_FAILED;
+    if(fd != STDIN_FILENO && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED){
+        //一般檔案：整個 mmap 進來，直接從 page cache 切行送出
+        madvise(map, st.st_size, MADV_SEQUENTIAL); //advice 是列舉值不是 bit flag，要分開呼叫
+        madvise(map, st.st_size, MADV_WILLNEED);
+        send_mapped(map, st.st_size, mailbox);
+        munmap(map, st.st_size);
+    }
+    else if(mailbox_mechanism(mailbox) == transport_mechanism(transport_find("uring"))){
+        send_uring(fd, mailbox);
+    }
+    else{
+        send_fd(fd, mailbox); //pipe / stdin 無法 mmap
+    }
+    if(fd != STDIN_FILENO)
+        close(fd);
+    long long start = now_ns();
+    mailbox_send_eof(mailbox);
+    time_taken += (now_ns() - start) * 1e-9;
+
+    mailbox_stats_t stats;
+    mailbox_stats(mailbox, &stats);
+    sink_close(&sink);
     printf("\e[1;31\nmEnd of input file! exit!\e[m\n");
     printf("Total time taken in sending msg: %f s\n", time_taken);
-    sem_close(send_sem);
-    sem_close(rec_sem);
+    sink_print(&sink);
+    if(config.lanes > 1){
+        printf("Lanes:");
+        for(unsigned int lane = 0; lane < config.lanes; lane++)
+            printf(" %u: %llu%s", lane, stats.lane_messages[lane], lane + 1 < config.lanes ? "," : "\n");
+    }
+    if(coalesce_us >= 0)
+        printf("Coalesced %llu lines into %llu batches (%.1f lines/batch)\n", stats.batched, stats.batches, stats.batches ? (double)stats.batched / stats.batches : 0);
+    if(config.wait == MAILBOX_WAIT_POLL){
+        poll_stats_t poll_stats = {stats.poll_idle_ns, stats.polls};
+        poll_print(&poll_stats, cpu);
+    }
+    mailbox_print_stats(mailbox, stdout);
+    timing_print(stdout);
+    mailbox_close(mailbox);
     return 0;
 }
@@ -0,0 +1,50 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include "ring.h"
+
+/*
+ * Conflating(latest-value) mailbox：共享記憶體中只有一個 value，writer 永遠不等待，
+ * 以 seqlock 發布：version 為奇數時正在寫入，每次發布後加 2。
+ * reader 複製一份 snapshot，前後讀到的 version 相同且為偶數才算一致，否則重試(torn read)；
+ * 兩次讀到的 version 相差超過 2 表示中間的 value 已被覆蓋(conflated)。
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_uint version;
+    atomic_int ready; //sender 初始化完成後設為 1
+    _Alignas(CACHE_LINE) unsigned char value[];
+} seqlock_t;
+
+static inline size_t seqlock_bytes(size_t value_size){
+    return sizeof(seqlock_t) + value_size;
+}
+
+static inline void seqlock_init(seqlock_t* lock){
+    atomic_store_explicit(&lock -> version, 0, memory_order_relaxed);
+    atomic_store_explicit(&lock -> ready, 1, memory_order_release);
+}
+
+//writer：把 size bytes 寫進 value，不會等待 reader
+static inline void seqlock_publish(seqlock_t* lock, const void* data, size_t size){
+    unsigned int version = atomic_load_explicit(&lock -> version, memory_order_relaxed);
+    atomic_store_explicit(&lock -> version, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); //reader 看到新的資料時一定也看到奇數的 version
+    memcpy(lock -> value, data, size);
+    atomic_store_explicit(&lock -> version, version + 2, memory_order_release);
+}
+
+//目前已發布的 version，沒有正在寫入時為偶數
+static inline unsigned int seqlock_version(seqlock_t* lock){
+    return atomic_load_explicit(&lock -> version, memory_order_acquire);
+}
+
+//reader：從 value 複製完 snapshot 後呼叫，複製期間 writer 有寫入(snapshot 可能不完整)時回傳 1，應重新讀取
+static inline int seqlock_retry(seqlock_t* lock, unsigned int version){
+    atomic_thread_fence(memory_order_acquire); //複製完成後才讀第二次 version
+    return atomic_load_explicit(&lock -> version, memory_order_relaxed) != version;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+/*
+ * 每則訊息的輸出，由 -o 在啟動時選擇：
+ *   console      原本的彩色 "Sending / Receiving message: ..."(預設)
+ *   quiet        不輸出，只計數，benchmark 時量到的是 IPC 本身而不是 terminal
+ *   file:PATH    只寫 payload 本身(可以直接和輸入檔比對)，主執行緒複製進 SINK_BUFS 個大 buffer，
+ *                由專門的 writer thread 以一次 writev 寫出所有已填滿的 buffer
+ */
+#define SINK_CONSOLE 0
+#define SINK_QUIET 1
+#define SINK_FILE 2
+
+#define SINK_BUF_SIZE (1 << 20)
+#define SINK_BUFS 4
+
+typedef struct {
+    int mode;
+    int fd;
+    const char* path;
+    char* bufs[SINK_BUFS];
+    size_t lens[SINK_BUFS];
+    unsigned int head; //下一個要填的 buffer 序號
+    unsigned int tail; //writer 下一個要寫的序號，[tail, head) 為已填滿、等待寫出的 buffer
+    size_t fill; //bufs[head % SINK_BUFS] 已填入的 bytes
+    int closing;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    unsigned long long messages;
+    unsigned long long bytes;
+    unsigned long long writes; //writev 次數
+    unsigned long long stalls; //所有 buffer 都在等 writer 而必須等待的次數
+} sink_t;
+
+//把 iov 全部寫完，處理 partial write
+static inline void sink_writev_all(int fd, struct iovec* iov, int count){
+    while(count > 0){
+        ssize_t n = writev(fd, iov, count);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n == -1){
+            perror("writev failed");
+            exit(1);
+        }
+        while(count > 0 && (size_t)n >= iov -> iov_len){
+            n -= iov -> iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov -> iov_base = (char*)iov -> iov_base + n;
+            iov -> iov_len -= n;
+        }
+    }
+}
+
+static inline void* sink_writer(void* arg){
+    sink_t* sink = arg;
+    struct iovec iov[SINK_BUFS];
+    unsigned int tail, count, i;
+    pthread_mutex_lock(&sink -> lock);
+    while(1){
+        while(sink -> tail == sink -> head && !sink -> closing)
+            pthread_cond_wait(&sink -> cond, &sink -> lock);
+        if(sink -> tail == sink -> head) //closing 且已全部寫完
+            break;
+        tail = sink -> tail;
+        count = sink -> head - tail;
+        pthread_mutex_unlock(&sink -> lock);
+
+        for(i = 0; i < count; i++){ //buffer 已交給 writer，寫出時不需要持有 lock
+            iov[i].iov_base = sink -> bufs[(tail + i) % SINK_BUFS];
+            iov[i].iov_len = sink -> lens[(tail + i) % SINK_BUFS];
+        }
+        sink_writev_all(sink -> fd, iov, count);
+
+        pthread_mutex_lock(&sink -> lock);
+        sink -> writes++;
+        sink -> tail = tail + count;
+        pthread_cond_broadcast(&sink -> cond);
+    }
+    pthread_mutex_unlock(&sink -> lock);
+    return NULL;
+}
+
+//解析 -o 的參數並開始輸出，格式錯誤時回傳 -1
+static inline int sink_open(sink_t* sink, const char* spec){
+    memset(sink, 0, sizeof(sink_t));
+    sink -> fd = -1;
+    if(spec == NULL || strcmp(spec, "console") == 0){
+        sink -> mode = SINK_CONSOLE;
+        return 0;
+    }
+    if(strcmp(spec, "quiet") == 0){
+        sink -> mode = SINK_QUIET;
+        return 0;
+    }
+    if(strncmp(spec, "file:", 5) != 0 || spec[5] == '\0')
+        return -1;
+    sink -> mode = SINK_FILE;
+    sink -> path = spec + 5;
+    sink -> fd = open(sink -> path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(sink -> fd == -1){
+        perror("open output file failed");
+        exit(1);
+    }
+    for(int i = 0; i < SINK_BUFS; i++){
+        sink -> bufs[i] = malloc(SINK_BUF_SIZE);
+        if(!sink -> bufs[i]){
+            perror("malloc failed");
+            exit(1);
+        }
+    }
+    pthread_mutex_init(&sink -> lock, NULL);
+    pthread_cond_init(&sink -> cond, NULL);
+    if(pthread_create(&sink -> thread, NULL, sink_writer, sink) != 0){
+        perror("pthread_create failed");
+        exit(1);
+    }
+    return 0;
+}
+
+//把目前的 buffer 交給 writer thread，所有 buffer 都還沒寫完時等待
+static inline void sink_submit(sink_t* sink){
+    pthread_mutex_lock(&sink -> lock);
+    sink -> lens[sink -> head % SINK_BUFS] = sink -> fill;
+    sink -> head++;
+    pthread_cond_broadcast(&sink -> cond);
+    if(sink -> head - sink -> tail == SINK_BUFS){
+        sink -> stalls++;
+        while(sink -> head - sink -> tail == SINK_BUFS)
+            pthread_cond_wait(&sink -> cond, &sink -> lock);
+    }
+    pthread_mutex_unlock(&sink -> lock);
+    sink -> fill = 0;
+}
+
+static inline void sink_append(sink_t* sink, const char* data, size_t len){
+    while(len > 0){
+        size_t room = SINK_BUF_SIZE - sink -> fill;
+        size_t n = len < room ? len : room;
+        memcpy(sink -> bufs[sink -> head % SINK_BUFS] + sink -> fill, data, n);
+        sink -> fill += n;
+        data += n;
+        len -= n;
+        if(sink -> fill == SINK_BUF_SIZE)
+            sink_submit(sink);
+    }
+}
+
+/*
+ * 輸出一則訊息：console 時先印 prefix(彩色的 "... message: ")，prefix 為 NULL 表示接續上一則(長行的後半段)。
+ * file 只寫 data，quiet 只計數。
+ */
+static inline void sink_message(sink_t* sink, const char* prefix, const char* data, size_t len){
+    if(prefix)
+        sink -> messages++;
+    sink -> bytes += len;
+    if(sink -> mode == SINK_CONSOLE){
+        if(prefix)
+            fputs(prefix, stdout);
+        fwrite(data, 1, len, stdout);
+    }
+    else if(sink -> mode == SINK_FILE){
+        sink_append(sink, data, len);
+    }
+}
+
+//寫出剩下的資料並結束 writer thread
+static inline void sink_close(sink_t* sink){
+    if(sink -> mode != SINK_FILE)
+        return;
+    if(sink -> fill > 0)
+        sink_submit(sink);
+    pthread_mutex_lock(&sink -> lock);
+    sink -> closing = 1;
+    pthread_cond_broadcast(&sink -> cond);
+    pthread_mutex_unlock(&sink -> lock);
+    pthread_join(sink -> thread, NULL);
+    close(sink -> fd);
+    for(int i = 0; i < SINK_BUFS; i++)
+        free(sink -> bufs[i]);
+    pthread_mutex_destroy(&sink -> lock);
+    pthread_cond_destroy(&sink -> cond);
+}
+
+static inline void sink_print(sink_t* sink){
+    if(sink -> mode == SINK_QUIET)
+        printf("Output: quiet, %llu messages (%llu bytes) discarded\n", sink -> messages, sink -> bytes);
+    else if(sink -> mode == SINK_FILE)
+        printf("Output: %s, %llu messages, %llu bytes in %llu writev calls, %llu stalls\n",
+               sink -> path, sink -> messages, sink -> bytes, sink -> writes, sink -> stalls);
+}
+
+#endif
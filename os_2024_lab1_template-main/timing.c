@@ -0,0 +1,101 @@
+#include "timing.h"
+#ifdef TIMING_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+#define TIMING_SAMPLES 8 //每次取樣讀幾次，取 rdtscp 前後間隔最短的一次
+#define TIMING_OVERHEAD_CALLS 1000
+
+timing_clock_t timing_clock;
+
+#ifdef TIMING_HAVE_TSC
+//rdtscp 與 invariant TSC(CPUID 0x80000001 EDX bit 27、0x80000007 EDX bit 8)都支援時才使用 TSC
+static int tsc_usable(void){
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    if(!(edx & (1u << 27)))
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+}
+
+//同時讀 TSC 與 CLOCK_MONOTONIC：clock_gettime 前後各讀一次 TSC，取間隔最短(最少被打斷)的一組的中點
+static void tsc_sample(unsigned long long* tsc, long long* ns){
+    unsigned long long best = ~0ULL;
+    unsigned int aux;
+    *tsc = 0; //第一次取樣一定會覆蓋
+    *ns = 0;
+    for(int i = 0; i < TIMING_SAMPLES; i++){
+        unsigned long long before = __rdtscp(&aux);
+        long long now = timing_clock_ns();
+        unsigned long long after = __rdtscp(&aux);
+        if(after - before < best){
+            best = after - before;
+            *tsc = before + (after - before) / 2;
+            *ns = now;
+        }
+    }
+}
+
+static int tsc_calibrate(void){
+    unsigned long long start_tsc, end_tsc;
+    long long start_ns, end_ns;
+    tsc_sample(&start_tsc, &start_ns);
+    while(timing_clock_ns() - start_ns < TIMING_CALIBRATE_NS)
+        ;
+    tsc_sample(&end_tsc, &end_ns);
+    if(end_tsc <= start_tsc)
+        return 0;
+    timing_clock.ghz = (double)(end_tsc - start_tsc) / (end_ns - start_ns);
+    if(timing_clock.ghz < 0.1 || timing_clock.ghz > 20) //校正結果不合理(例如被搬到另一顆 TSC 不同步的 CPU)
+        return 0;
+    timing_clock.mult = (unsigned long long)(((unsigned __int128)(end_ns - start_ns) << TIMING_SHIFT) / (end_tsc - start_tsc));
+    timing_clock.base_tsc = end_tsc;
+    timing_clock.base_ns = end_ns;
+    return 1;
+}
+#endif
+
+void timing_init(void){
+    volatile long long sink = 0;
+    long long start;
+    if(timing_clock.ready)
+        return;
+#ifdef TIMING_HAVE_TSC
+    timing_clock.tsc = tsc_usable() && tsc_calibrate();
+#endif
+    timing_clock.ready = 1;
+
+    //自己的成本：連續讀 TIMING_OVERHEAD_CALLS 次的平均
+    start = timing_clock_ns();
+    for(int i = 0; i < TIMING_OVERHEAD_CALLS; i++)
+        sink += timing_now_ns();
+    timing_clock.overhead_ns = (double)(timing_clock_ns() - start) / TIMING_OVERHEAD_CALLS;
+    start = timing_clock_ns();
+    for(int i = 0; i < TIMING_OVERHEAD_CALLS; i++)
+        sink += timing_clock_ns();
+    timing_clock.clock_overhead_ns = (double)(timing_clock_ns() - start) / TIMING_OVERHEAD_CALLS;
+    (void)sink;
+}
+
+void timing_print(FILE* file){
+    if(!timing_clock.ready)
+        timing_init();
+#ifdef TIMING_HAVE_TSC
+    if(timing_clock.tsc){
+        //準確度：現在換算出的時間與 CLOCK_MONOTONIC 的差距，除以距離校正的時間即為倍率的誤差(ppm)
+        unsigned long long tsc;
+        long long ns, skew, elapsed;
+        tsc_sample(&tsc, &ns);
+        skew = timing_stamp_ns((long long)tsc, 1) - ns;
+        elapsed = ns - timing_clock.base_ns;
+        fprintf(file, "Timer: TSC via rdtscp (%.3f GHz), %.1f ns per reading (clock_gettime %.1f ns), skew %+lld ns after %.3f s (%+.2f ppm)\n",
+                timing_clock.ghz, timing_clock.overhead_ns, timing_clock.clock_overhead_ns,
+                skew, elapsed * 1e-9, elapsed > 0 ? skew * 1e6 / elapsed : 0.0);
+        return;
+    }
+#endif
+    fprintf(file, "Timer: clock_gettime(CLOCK_MONOTONIC), %.1f ns per reading\n", timing_clock.overhead_ns);
+}
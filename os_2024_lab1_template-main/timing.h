@@ -0,0 +1,88 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) && !defined(TIMING_NO_TSC)
+#include <x86intrin.h>
+#define TIMING_HAVE_TSC 1
+#endif
+
+/*
+ * 每則訊息的計時(send_ns、latency、time_taken)都經過 timing_now_ns()。
+ * CPU 有 invariant TSC 時讀 rdtscp，啟動時對 CLOCK_MONOTONIC 校正倍率與起點，
+ * 換算後仍然是 CLOCK_MONOTONIC 的 ns，不同行程的時間可以直接相減(例如 one-way latency)。
+ * TSC 不是 invariant(會隨頻率或睡眠改變)時改用 clock_gettime(vDSO)。
+ * 以 -DTIMING_NO_TSC 編譯時一律使用 clock_gettime。
+ */
+#define TIMING_SHIFT 32 //ns = ticks * mult >> TIMING_SHIFT
+#define TIMING_CALIBRATE_NS 10000000LL //校正時取樣的間隔，越長倍率越準(10 ms 約為 ppm 等級)
+
+typedef struct {
+    int ready;
+    int tsc; //1: rdtscp，0: clock_gettime
+    unsigned long long base_tsc; //校正結束時的 TSC 與對應的 CLOCK_MONOTONIC
+    long long base_ns;
+    unsigned long long mult;
+    double ghz;
+    double overhead_ns; //一次 timing_now_ns() 的成本
+    double clock_overhead_ns; //一次 clock_gettime() 的成本，用來比較
+} timing_clock_t;
+
+extern timing_clock_t timing_clock;
+
+void timing_init(void); //已初始化時直接回傳；第一次呼叫時校正約 TIMING_CALIBRATE_NS
+void timing_print(FILE* file); //使用的時間來源、每次讀取的成本，與校正後相對 CLOCK_MONOTONIC 的偏差
+
+static inline long long timing_clock_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); //CLOCK_MONOTONIC 在同一台機器的不同行程間可以直接相減
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline long long timing_now_ns(void){
+    if(!timing_clock.ready)
+        timing_init();
+#ifdef TIMING_HAVE_TSC
+    if(timing_clock.tsc){
+        unsigned int aux;
+        unsigned long long ticks = __rdtscp(&aux) - timing_clock.base_tsc;
+        return timing_clock.base_ns + (long long)(((unsigned __int128)ticks * timing_clock.mult) >> TIMING_SHIFT);
+    }
+#endif
+    return timing_clock_ns();
+}
+
+/*
+ * 跨行程的時間戳記(frame 的 send_ns)：TSC 模式下為 raw 的 rdtscp tick，不經過本行程的校正；
+ * 讀取的一方以 timing_stamp_ns() 用自己的校正換算，與自己的 timing_now_ns() 相減時只剩一份校正的誤差，
+ * 兩個行程各自校正的倍率差異不會隨執行時間累積成 latency 的偏差(甚至變成負值)。
+ */
+static inline long long timing_now_stamp(void){
+    if(!timing_clock.ready)
+        timing_init();
+#ifdef TIMING_HAVE_TSC
+    if(timing_clock.tsc){
+        unsigned int aux;
+        return (long long)__rdtscp(&aux);
+    }
+#endif
+    return timing_clock_ns();
+}
+
+//tsc：stamp 是否為 TSC tick；不是時已經是 CLOCK_MONOTONIC 的 ns
+static inline long long timing_stamp_ns(long long stamp, int tsc){
+    if(!tsc)
+        return stamp;
+    if(!timing_clock.ready)
+        timing_init();
+#ifdef TIMING_HAVE_TSC
+    if(timing_clock.tsc){
+        long long ticks = (long long)((unsigned long long)stamp - timing_clock.base_tsc); //校正之前的 stamp 為負值
+        return timing_clock.base_ns + (long long)(((__int128)ticks * (__int128)timing_clock.mult) >> TIMING_SHIFT);
+    }
+#endif
+    return timing_clock_ns(); //本行程無法使用 TSC(例如校正失敗)時無法換算，視為剛送出
+}
+
+#endif
@@ -0,0 +1,693 @@
+#define _GNU_SOURCE //vmsplice, F_GETPIPE_SZ
+#include "transport.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/msg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include "ring.h"
+#include "uring.h"
+
+#define FRAME_HEADER sizeof(uint64_t) //stream 與 eventfd ring 在 payload 前放 8 bytes 的長度，payload 保持 8-byte 對齊
+#define FRAME_SIZE(len) (FRAME_HEADER + (((len) + 7) & ~(size_t)7)) //stream 中每個 frame 補齊到 8 bytes，下一個 frame 的 payload 也對齊
+#define STREAM_BUF_MIN (1 << 16) //stream receiver 一次 read 的量，小訊息時一個 syscall 可以收很多則
+
+static void write_full(transport_t* transport, const char* buf, size_t len){
+    while(len > 0){
+        ssize_t written = write(transport -> fd, buf, len);
+        transport -> syscalls++;
+        if(written == -1){
+            if(errno == EINTR)
+                continue;
+            perror("write failed");
+            exit(1);
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+static void count_message(transport_t* transport, size_t len){
+    transport -> messages++;
+    transport -> bytes += len;
+}
+
+//sender 建立 fifo，receiver 也先嘗試建立，誰先啟動都可以；open 會等到另一端也 open 才返回
+static void fifo_create(const char* path){
+    if(mkfifo(path, 0666) == -1 && errno != EEXIST){
+        perror("mkfifo failed");
+        exit(1);
+    }
+}
+
+static void fifo_open_end(transport_t* transport, const char* path){
+    fifo_create(path);
+    transport -> fd = open(path, transport -> role == TRANSPORT_SENDER ? O_WRONLY : O_RDONLY);
+    if(transport -> fd == -1){
+        perror("open fifo failed");
+        exit(1);
+    }
+    snprintf(transport -> path, sizeof(transport -> path), "%s", path);
+}
+
+static void stream_alloc(transport_t* transport){
+    transport -> buf_size = FRAME_SIZE(transport -> max_message);
+    if(transport -> role == TRANSPORT_RECEIVER && transport -> buf_size * 2 < STREAM_BUF_MIN)
+        transport -> buf_size = STREAM_BUF_MIN;
+    else if(transport -> role == TRANSPORT_RECEIVER)
+        transport -> buf_size *= 2;
+    transport -> buf = malloc(transport -> buf_size);
+    if(!transport -> buf){
+        perror("malloc failed");
+        exit(1);
+    }
+}
+
+//確保 buf 中至少有 need bytes 尚未解析的資料，不夠時把剩下的搬到最前面再 read
+static void stream_fill(transport_t* transport, size_t need){
+    while(transport -> buf_len - transport -> buf_pos < need){
+        ssize_t received;
+        if(transport -> buf_pos > 0){
+            memmove(transport -> buf, transport -> buf + transport -> buf_pos, transport -> buf_len - transport -> buf_pos);
+            transport -> buf_len -= transport -> buf_pos;
+            transport -> buf_pos = 0;
+        }
+        received = read(transport -> fd, transport -> buf + transport -> buf_len, transport -> buf_size - transport -> buf_len);
+        transport -> syscalls++;
+        if(received == -1 && errno == EINTR)
+            continue;
+        if(received <= 0){
+            if(received == -1)
+                perror("read failed");
+            else
+                fprintf(stderr, "transport closed by sender\n");
+            exit(1);
+        }
+        transport -> buf_len += received;
+    }
+}
+
+static size_t stream_recv(transport_t* transport, void* buf, size_t cap){
+    uint64_t len;
+    stream_fill(transport, FRAME_HEADER);
+    memcpy(&len, transport -> buf + transport -> buf_pos, FRAME_HEADER);
+    if(len > cap || len > transport -> max_message){
+        fprintf(stderr, "frame of %llu bytes exceeds buffer\n", (unsigned long long)len);
+        exit(1);
+    }
+    stream_fill(transport, FRAME_SIZE(len));
+    memcpy(buf, transport -> buf + transport -> buf_pos + FRAME_HEADER, len);
+    transport -> buf_pos += FRAME_SIZE(len);
+    count_message(transport, len);
+    return len;
+}
+
+/* ---------- named pipe：長度 + payload(補齊 8 bytes) 以一次 write 送出，receiver 批次 read 後自行切開 ---------- */
+
+static void fifo_open(transport_t* transport, const ipc_names_t* names){
+    fifo_open_end(transport, names -> fifo);
+    stream_alloc(transport);
+}
+
+static void* fifo_reserve(transport_t* transport){
+    return transport -> buf + FRAME_HEADER;
+}
+
+static void fifo_send(transport_t* transport, const void* buf, size_t len){
+    uint64_t header = len;
+    if(buf != transport -> buf + FRAME_HEADER)
+        memcpy(transport -> buf + FRAME_HEADER, buf, len);
+    memcpy(transport -> buf, &header, FRAME_HEADER);
+    write_full(transport, transport -> buf, FRAME_SIZE(len));
+    count_message(transport, len);
+}
+
+static void fifo_close(transport_t* transport){
+    close(transport -> fd);
+    if(transport -> role == TRANSPORT_RECEIVER)
+        unlink(transport -> path);
+}
+
+/* ---------- AF_UNIX SOCK_SEQPACKET：kernel 保留訊息邊界，一則訊息一個 syscall ---------- */
+
+static socklen_t unix_address(struct sockaddr_un* addr, const char* name){
+    memset(addr, 0, sizeof(*addr));
+    addr -> sun_family = AF_UNIX;
+    snprintf(addr -> sun_path + 1, sizeof(addr -> sun_path) - 1, "%s", name); //sun_path[0] = '\0': abstract namespace
+    return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr -> sun_path + 1);
+}
+
+//sender 端：listen 並等待 receiver 連線
+static int unix_accept(const char* name){
+    struct sockaddr_un addr;
+    socklen_t addr_len = unix_address(&addr, name);
+    int listen_fd, fd;
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(listen_fd == -1){
+        perror("socket failed");
+        exit(1);
+    }
+    if(bind(listen_fd, (struct sockaddr*)&addr, addr_len) == -1 || listen(listen_fd, 1) == -1){
+        perror("bind failed");
+        exit(1);
+    }
+    while((fd = accept(listen_fd, NULL, NULL)) == -1){
+        if(errno != EINTR){
+            perror("accept failed");
+            exit(1);
+        }
+    }
+    close(listen_fd);
+    return fd;
+}
+
+//receiver 端：sender 還沒 listen 時重試
+static int unix_connect(const char* name){
+    struct sockaddr_un addr;
+    socklen_t addr_len = unix_address(&addr, name);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(fd == -1){
+        perror("socket failed");
+        exit(1);
+    }
+    while(connect(fd, (struct sockaddr*)&addr, addr_len) == -1){
+        if(errno != ECONNREFUSED && errno != ENOENT){
+            perror("connect failed");
+            exit(1);
+        }
+        usleep(1000);
+    }
+    return fd;
+}
+
+static void seqpacket_open(transport_t* transport, const ipc_names_t* names){
+    if(transport -> role == TRANSPORT_SENDER){
+        transport -> fd = unix_accept(names -> socket);
+        transport -> buf_size = transport -> max_message;
+        transport -> buf = malloc(transport -> buf_size);
+        if(!transport -> buf){
+            perror("malloc failed");
+            exit(1);
+        }
+    }
+    else{
+        transport -> fd = unix_connect(names -> socket);
+    }
+}
+
+static void* seqpacket_reserve(transport_t* transport){
+    return transport -> buf;
+}
+
+static void seqpacket_send(transport_t* transport, const void* buf, size_t len){
+    write_full(transport, buf, len); //SOCK_SEQPACKET 的 write 不會只寫一部分
+    count_message(transport, len);
+}
+
+static size_t seqpacket_recv(transport_t* transport, void* buf, size_t cap){
+    ssize_t received;
+    do{
+        received = read(transport -> fd, buf, cap);
+        transport -> syscalls++;
+    }while(received == -1 && errno == EINTR);
+    if(received <= 0){
+        if(received == -1)
+            perror("read failed");
+        else
+            fprintf(stderr, "transport closed by sender\n");
+        exit(1);
+    }
+    count_message(transport, received);
+    return received;
+}
+
+static void seqpacket_close(transport_t* transport){
+    close(transport -> fd);
+}
+
+/* ---------- System V message queue：mailbox_t 原本註解掉的 msqid ---------- */
+
+struct transport_msgbuf {
+    long mtype;
+    char mtext[];
+};
+
+//System V IPC 以整數 key 命名，把名稱 hash 成 key(FNV-1a)，-n channel 時 key 也會不同
+static key_t sysv_key(const char* name){
+    uint32_t hash = 2166136261u;
+    for(; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return (key_t)(hash & 0x7fffffff);
+}
+
+static void sysv_open(transport_t* transport, const ipc_names_t* names){
+    transport -> msqid = msgget(sysv_key(names -> sysv), IPC_CREAT | 0666);
+    if(transport -> msqid == -1){
+        perror("msgget failed");
+        exit(1);
+    }
+    transport -> buf_size = sizeof(struct transport_msgbuf) + transport -> max_message;
+    transport -> buf = malloc(transport -> buf_size);
+    if(!transport -> buf){
+        perror("malloc failed");
+        exit(1);
+    }
+    ((struct transport_msgbuf*)transport -> buf) -> mtype = 1;
+}
+
+static void* sysv_reserve(transport_t* transport){
+    return ((struct transport_msgbuf*)transport -> buf) -> mtext;
+}
+
+static void sysv_send(transport_t* transport, const void* buf, size_t len){
+    struct transport_msgbuf* msg = (struct transport_msgbuf*)transport -> buf;
+    if(buf != msg -> mtext)
+        memcpy(msg -> mtext, buf, len);
+    while(msgsnd(transport -> msqid, msg, len, 0) == -1){
+        transport -> syscalls++;
+        if(errno != EINTR){
+            perror("msgsnd failed");
+            exit(1);
+        }
+    }
+    transport -> syscalls++;
+    count_message(transport, len);
+}
+
+static size_t sysv_recv(transport_t* transport, void* buf, size_t cap){
+    struct transport_msgbuf* msg = (struct transport_msgbuf*)transport -> buf;
+    ssize_t received;
+    while((received = msgrcv(transport -> msqid, msg, transport -> max_message, 0, 0)) == -1){
+        transport -> syscalls++;
+        if(errno != EINTR){
+            perror("msgrcv failed");
+            exit(1);
+        }
+    }
+    transport -> syscalls++;
+    if((size_t)received > cap){
+        fprintf(stderr, "message of %zd bytes exceeds buffer\n", received);
+        exit(1);
+    }
+    memcpy(buf, msg -> mtext, received);
+    count_message(transport, received);
+    return received;
+}
+
+static void sysv_close(transport_t* transport){
+    if(transport -> role == TRANSPORT_RECEIVER)
+        msgctl(transport -> msqid, IPC_RMID, NULL); //receiver 最後離開，負責移除
+}
+
+/*
+ * ---------- eventfd + shared memory ----------
+ * 資料走 ring.h 的 ring buffer，只有在對方已經睡著時才寫 eventfd 叫醒它。
+ * 等待的一方先設 *_waiting 再檢查一次 ring，通知的一方先更新 ring 再檢查 *_waiting，
+ * 兩邊中間都有 seq_cst fence，所以至少有一方會看到另一方的寫入，不會漏掉通知。
+ * eventfd 無法以名稱開啟，sender 建立後透過 abstract socket 以 SCM_RIGHTS 傳給 receiver。
+ */
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int sender_waiting;
+    _Alignas(CACHE_LINE) atomic_int receiver_waiting;
+} efd_shared_t;
+
+static ring_t* efd_ring(transport_t* transport){
+    return (ring_t*)((char*)transport -> shared + sizeof(efd_shared_t));
+}
+
+static void efd_signal(transport_t* transport, int fd){
+    uint64_t one = 1;
+    while(write(fd, &one, sizeof(one)) == -1 && errno == EINTR)
+        ;
+    transport -> syscalls++;
+}
+
+static void efd_sleep(transport_t* transport, int fd){
+    uint64_t count;
+    while(read(fd, &count, sizeof(count)) == -1 && errno == EINTR)
+        ;
+    transport -> syscalls++;
+    transport -> sleeps++;
+}
+
+static void efd_send_fds(int sock, int* fds, int count){
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    struct msghdr msg = {0};
+    struct cmsghdr* cmsg;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg -> cmsg_level = SOL_SOCKET;
+    cmsg -> cmsg_type = SCM_RIGHTS;
+    cmsg -> cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    if(sendmsg(sock, &msg, 0) == -1){
+        perror("sendmsg failed");
+        exit(1);
+    }
+}
+
+static void efd_recv_fds(int sock, int* fds, int count){
+    char byte;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    struct msghdr msg = {0};
+    struct cmsghdr* cmsg;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    if(recvmsg(sock, &msg, 0) <= 0 || (cmsg = CMSG_FIRSTHDR(&msg)) == NULL || cmsg -> cmsg_type != SCM_RIGHTS){
+        perror("recvmsg failed");
+        exit(1);
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+}
+
+static void efd_open(transport_t* transport, const ipc_names_t* names){
+    unsigned int slots = transport -> depth ? transport -> depth : RING_SLOTS;
+    unsigned int slot_size = ring_slot_size(FRAME_HEADER + transport -> max_message);
+    int fds[2];
+    int shm_fd, sock;
+    if(slots & (slots - 1)){
+        printf("eventfd ring depth must be a power of 2\n");
+        exit(1);
+    }
+    snprintf(transport -> path, sizeof(transport -> path), "%s", names -> efd);
+    if(transport -> role == TRANSPORT_SENDER){
+        transport -> shared_size = sizeof(efd_shared_t) + ring_bytes(slots, slot_size);
+        shm_unlink(names -> efd);
+        shm_fd = shm_open(names -> efd, O_CREAT | O_RDWR, 0666);
+        if(shm_fd == -1 || ftruncate(shm_fd, transport -> shared_size) == -1){
+            perror("shm_open failed");
+            exit(1);
+        }
+    }
+    else{
+        struct stat st;
+        sock = unix_connect(names -> efd); //sender 在 listen 之前已經建好 shared memory
+        efd_recv_fds(sock, fds, 2);
+        close(sock);
+        shm_fd = shm_open(names -> efd, O_RDWR, 0666);
+        if(shm_fd == -1 || fstat(shm_fd, &st) == -1){
+            perror("shm_open failed");
+            exit(1);
+        }
+        transport -> shared_size = st.st_size;
+    }
+    transport -> shared = mmap(0, transport -> shared_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if(transport -> shared == MAP_FAILED){
+        perror("mmap failed");
+        exit(1);
+    }
+    close(shm_fd);
+    if(transport -> role == TRANSPORT_SENDER){
+        ring_init(efd_ring(transport), slots, slot_size);
+        fds[0] = eventfd(0, EFD_CLOEXEC);
+        fds[1] = eventfd(0, EFD_CLOEXEC);
+        if(fds[0] == -1 || fds[1] == -1){
+            perror("eventfd failed");
+            exit(1);
+        }
+        sock = unix_accept(names -> efd);
+        efd_send_fds(sock, fds, 2);
+        close(sock);
+    }
+    transport -> data_fd = fds[0];
+    transport -> space_fd = fds[1];
+}
+
+static void* efd_reserve(transport_t* transport){
+    efd_shared_t* shared = transport -> shared;
+    ring_t* ring = efd_ring(transport);
+    char* slot;
+    if(transport -> reserved)
+        return transport -> reserved;
+    while((slot = ring_try_reserve(ring)) == NULL){
+        atomic_store(&shared -> sender_waiting, 1);
+        if((slot = ring_try_reserve(ring)) != NULL){
+            atomic_store(&shared -> sender_waiting, 0);
+            break;
+        }
+        efd_sleep(transport, transport -> space_fd);
+    }
+    transport -> reserved = slot + FRAME_HEADER;
+    return transport -> reserved;
+}
+
+static void efd_send(transport_t* transport, const void* buf, size_t len){
+    efd_shared_t* shared = transport -> shared;
+    char* payload = efd_reserve(transport);
+    uint64_t header = len;
+    if(buf != payload)
+        memcpy(payload, buf, len);
+    memcpy(payload - FRAME_HEADER, &header, FRAME_HEADER);
+    ring_commit(efd_ring(transport));
+    transport -> reserved = NULL;
+    count_message(transport, len);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&shared -> receiver_waiting, memory_order_relaxed) && atomic_exchange(&shared -> receiver_waiting, 0))
+        efd_signal(transport, transport -> data_fd);
+}
+
+static size_t efd_recv(transport_t* transport, void* buf, size_t cap){
+    efd_shared_t* shared = transport -> shared;
+    ring_t* ring = efd_ring(transport);
+    char* slot;
+    uint64_t len;
+    while((slot = ring_try_peek(ring)) == NULL){
+        atomic_store(&shared -> receiver_waiting, 1);
+        if((slot = ring_try_peek(ring)) != NULL){
+            atomic_store(&shared -> receiver_waiting, 0);
+            break;
+        }
+        efd_sleep(transport, transport -> data_fd);
+    }
+    memcpy(&len, slot, FRAME_HEADER);
+    if(len > cap){
+        fprintf(stderr, "message of %llu bytes exceeds buffer\n", (unsigned long long)len);
+        exit(1);
+    }
+    memcpy(buf, slot + FRAME_HEADER, len);
+    ring_release(ring);
+    count_message(transport, len);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&shared -> sender_waiting, memory_order_relaxed) && atomic_exchange(&shared -> sender_waiting, 0))
+        efd_signal(transport, transport -> space_fd);
+    return len;
+}
+
+static void efd_close(transport_t* transport){
+    munmap(transport -> shared, transport -> shared_size);
+    close(transport -> data_fd);
+    close(transport -> space_fd);
+    if(transport -> role == TRANSPORT_RECEIVER)
+        shm_unlink(transport -> path);
+}
+
+/*
+ * ---------- vmsplice ----------
+ * sender 把訊息所在的 page 直接掛進 pipe，kernel 不複製資料，receiver 端照一般 fifo 讀取。
+ * page 在 receiver 讀走之前不能被改寫，所以 sender 在一塊 staging 區域中循環使用：
+ * pipe 最多同時容納 pipe_size bytes(每個 pipe buffer 至多一個 page)，
+ * staging 大於 2 * pipe_size 時，繞回開頭要覆寫的資料一定已經被 receiver 讀走。
+ */
+static void vmsplice_open(transport_t* transport, const ipc_names_t* names){
+    long pipe_size;
+    long page = sysconf(_SC_PAGESIZE);
+    fifo_open_end(transport, names -> splice);
+    if(transport -> role == TRANSPORT_RECEIVER){
+        stream_alloc(transport);
+        return;
+    }
+    pipe_size = fcntl(transport -> fd, F_GETPIPE_SZ);
+    if(pipe_size == -1){
+        perror("F_GETPIPE_SZ failed");
+        exit(1);
+    }
+    transport -> shared_size = (2 * pipe_size + FRAME_SIZE(transport -> max_message) + page - 1) / page * page;
+    transport -> shared = mmap(0, transport -> shared_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(transport -> shared == MAP_FAILED){
+        perror("mmap failed");
+        exit(1);
+    }
+    transport -> buf_pos = 0;
+}
+
+static void* vmsplice_reserve(transport_t* transport){
+    if(!transport -> reserved){
+        if(transport -> buf_pos + FRAME_SIZE(transport -> max_message) > transport -> shared_size)
+            transport -> buf_pos = 0;
+        transport -> reserved = (char*)transport -> shared + transport -> buf_pos + FRAME_HEADER;
+    }
+    return transport -> reserved;
+}
+
+static void vmsplice_send(transport_t* transport, const void* buf, size_t len){
+    char* payload = vmsplice_reserve(transport);
+    uint64_t header = len;
+    struct iovec iov;
+    if(buf != payload)
+        memcpy(payload, buf, len);
+    memcpy(payload - FRAME_HEADER, &header, FRAME_HEADER);
+    iov.iov_base = payload - FRAME_HEADER;
+    iov.iov_len = FRAME_SIZE(len);
+    while(iov.iov_len > 0){
+        ssize_t spliced = vmsplice(transport -> fd, &iov, 1, 0);
+        transport -> syscalls++;
+        if(spliced == -1){
+            if(errno == EINTR)
+                continue;
+            perror("vmsplice failed");
+            exit(1);
+        }
+        iov.iov_base = (char*)iov.iov_base + spliced;
+        iov.iov_len -= spliced;
+    }
+    transport -> buf_pos += FRAME_SIZE(len);
+    transport -> reserved = NULL;
+    count_message(transport, len);
+}
+
+static void vmsplice_close(transport_t* transport){
+    if(transport -> role == TRANSPORT_SENDER)
+        munmap(transport -> shared, transport -> shared_size);
+    fifo_close(transport);
+}
+
+static void transport_print_stats(transport_t* transport, FILE* file){
+    fprintf(file, "Transport %s: %llu messages, %llu bytes, %llu syscalls (%.2f per message)\n",
+            transport -> ops -> name, transport -> messages, transport -> bytes, transport -> syscalls,
+            transport -> messages ? (double)transport -> syscalls / transport -> messages : 0);
+}
+
+static void efd_stats(transport_t* transport, FILE* file){
+    transport_print_stats(transport, file);
+    fprintf(file, "Transport %s: blocked %llu times\n", transport -> ops -> name, transport -> sleeps);
+}
+
+/*
+ * ---------- io_uring ----------
+ * 與 fifo 相同的 frame 格式，sender 把 frame 累積在 uring_writer 的 buffer 中，
+ * 每 URING_BUF_SIZE bytes 才提交一次 IORING_OP_WRITE，多個 buffer 在 kernel 寫出時繼續填下一個。
+ * buffer 數量為 -q depth(預設 URING_DEPTH)。receiver 端與 fifo 相同，一次 read 收很多則。
+ */
+static void uring_open(transport_t* transport, const ipc_names_t* names){
+    uring_writer_t* writer;
+    fifo_open_end(transport, names -> fifo);
+    if(transport -> role == TRANSPORT_RECEIVER){
+        stream_alloc(transport);
+        return;
+    }
+    writer = malloc(sizeof(uring_writer_t));
+    if(!writer){
+        perror("malloc failed");
+        exit(1);
+    }
+    uring_writer_init(writer, transport -> fd, transport -> depth ? transport -> depth : URING_DEPTH, URING_BUF_SIZE);
+    transport -> uring = writer;
+}
+
+static void* uring_reserve(transport_t* transport){
+    if(!transport -> reserved)
+        transport -> reserved = uring_writer_reserve(transport -> uring, FRAME_SIZE(transport -> max_message)) + FRAME_HEADER;
+    return transport -> reserved;
+}
+
+static void uring_send(transport_t* transport, const void* buf, size_t len){
+    char* payload = uring_reserve(transport);
+    uint64_t header = len;
+    if(buf != payload)
+        memcpy(payload, buf, len);
+    memcpy(payload - FRAME_HEADER, &header, FRAME_HEADER);
+    uring_writer_commit(transport -> uring, FRAME_SIZE(len));
+    transport -> reserved = NULL;
+    count_message(transport, len);
+}
+
+static void uring_flush(transport_t* transport){
+    uring_writer_flush(transport -> uring);
+}
+
+static void uring_close(transport_t* transport){
+    if(transport -> role == TRANSPORT_SENDER){
+        uring_writer_close(transport -> uring); //等所有 buffer 都寫進 pipe 才關閉
+        free(transport -> uring);
+    }
+    fifo_close(transport);
+}
+
+static void uring_stats(transport_t* transport, FILE* file){
+    if(transport -> role == TRANSPORT_SENDER)
+        transport -> syscalls = uring_writer_syscalls(transport -> uring);
+    transport_print_stats(transport, file);
+}
+
+const transport_ops_t transports[] = {
+    {"fifo", fifo_open, fifo_reserve, fifo_send, NULL, stream_recv, fifo_close, transport_print_stats},
+    {"seqpacket", seqpacket_open, seqpacket_reserve, seqpacket_send, NULL, seqpacket_recv, seqpacket_close, transport_print_stats},
+    {"sysv", sysv_open, sysv_reserve, sysv_send, NULL, sysv_recv, sysv_close, transport_print_stats},
+    {"eventfd", efd_open, efd_reserve, efd_send, NULL, efd_recv, efd_close, efd_stats},
+    {"vmsplice", vmsplice_open, vmsplice_reserve, vmsplice_send, NULL, stream_recv, vmsplice_close, transport_print_stats},
+    {"uring", uring_open, uring_reserve, uring_send, uring_flush, stream_recv, uring_close, uring_stats},
+};
+const int transport_count = sizeof(transports) / sizeof(transports[0]);
+
+const transport_ops_t* transport_find(const char* mechanism){
+    char* end;
+    long number = strtol(mechanism, &end, 10);
+    if(*mechanism && *end == '\0'){
+        if(number >= TRANSPORT_FIRST && number < TRANSPORT_FIRST + transport_count)
+            return &transports[number - TRANSPORT_FIRST];
+        return NULL;
+    }
+    for(int i = 0; i < transport_count; i++){
+        if(strcmp(mechanism, transports[i].name) == 0)
+            return &transports[i];
+    }
+    return NULL;
+}
+
+int transport_mechanism(const transport_ops_t* ops){
+    return TRANSPORT_FIRST + (int)(ops - transports);
+}
+
+transport_t* transport_open(const transport_ops_t* ops, int role, const ipc_names_t* names, size_t max_message, unsigned int depth){
+    transport_t* transport = calloc(1, sizeof(transport_t));
+    if(!transport){
+        perror("calloc failed");
+        exit(1);
+    }
+    transport -> ops = ops;
+    transport -> role = role;
+    transport -> max_message = max_message;
+    transport -> depth = depth;
+    transport -> fd = -1;
+    ops -> open(transport, names);
+    return transport;
+}
+
+void transport_close(transport_t* transport){
+    transport -> ops -> close(transport);
+    free(transport -> buf);
+    free(transport);
+}
+
+size_t transport_buffered(transport_t* transport){
+    if(transport -> role != TRANSPORT_RECEIVER || !transport -> buf)
+        return 0;
+    return transport -> buf_len - transport -> buf_pos;
+}
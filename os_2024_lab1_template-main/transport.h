@@ -0,0 +1,71 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "ipc_names.h"
+
+/*
+ * 以 byte buffer 為單位傳送訊息的 transport backend，每個 backend 提供一組 transport_ops_t：
+ *   open     依 role 建立或連上 IPC 物件(sender 建立、receiver 等待並在 close 時移除)
+ *   reserve  回傳可直接寫入的 buffer，send 這個 buffer 時不需要再複製(可為 NULL)
+ *   send     送出一則訊息，訊息邊界由 backend 保留
+ *   flush    把 backend 內部累積的訊息立刻送出(只有會 batch 的 backend 需要，其他為 NULL)
+ *   recv     收下一則訊息並複製到 buf，回傳長度
+ *   close    釋放資源
+ *   stats    輸出訊息數、bytes 與 syscall 次數
+ * sender.c / receiver.c 的 mechanism 5 ~ 10 透過這層介面使用，見 transport_find()。
+ */
+#define TRANSPORT_FIRST 5 //transports[0] 對應的 mechanism 編號
+
+#define TRANSPORT_SENDER 0
+#define TRANSPORT_RECEIVER 1
+
+typedef struct transport transport_t;
+
+typedef struct {
+    const char* name;
+    void (*open)(transport_t* transport, const ipc_names_t* names);
+    void* (*reserve)(transport_t* transport);
+    void (*send)(transport_t* transport, const void* buf, size_t len);
+    void (*flush)(transport_t* transport);
+    size_t (*recv)(transport_t* transport, void* buf, size_t cap);
+    void (*close)(transport_t* transport);
+    void (*stats)(transport_t* transport, FILE* file);
+} transport_ops_t;
+
+struct transport {
+    const transport_ops_t* ops;
+    int role;
+    size_t max_message; //單則訊息的上限，用來配置 buffer / slot
+    unsigned int depth; //eventfd ring 的 slot 數，0 為預設值
+    int fd;
+    char path[NAME_MAX]; //需要在 close 時移除的 fifo 路徑或 shm 名稱
+    char* buf; //stream backend 的收送 buffer、SysV 的 msgbuf
+    size_t buf_size;
+    size_t buf_pos, buf_len; //stream receiver：buf 中尚未解析的範圍
+    char* reserved; //reserve 回傳、尚未 send 的 buffer
+    int msqid;
+    int data_fd, space_fd; //eventfd：「有新訊息」與「有空 slot」
+    void* shared;
+    size_t shared_size;
+    void* uring; //io_uring backend 的 uring_writer_t
+    unsigned long long messages;
+    unsigned long long bytes;
+    unsigned long long syscalls;
+    unsigned long long sleeps; //eventfd：因為沒有訊息 / 沒有空間而 block 的次數
+};
+
+extern const transport_ops_t transports[];
+extern const int transport_count;
+
+//mechanism 可以是編號("5") 或 backend 名稱("fifo")，找不到時回傳 NULL
+const transport_ops_t* transport_find(const char* mechanism);
+int transport_mechanism(const transport_ops_t* ops);
+transport_t* transport_open(const transport_ops_t* ops, int role, const ipc_names_t* names, size_t max_message, unsigned int depth);
+void transport_close(transport_t* transport);
+//receiver 已收進來、還沒交給呼叫者的 bytes；為 0 時下一次 recv 可能會 block
+size_t transport_buffered(transport_t* transport);
+
+#endif
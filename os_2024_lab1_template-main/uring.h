@@ -0,0 +1,452 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * 不依賴 liburing，直接用 io_uring_setup / io_uring_enter 與 mmap 出來的 SQ / CQ ring。
+ * 每個 request 的 user_data 是一個 uring_req_t*，reap 時呼叫它的 complete()，
+ * 所以 writer 與 reader 可以各自處理自己的 completion。
+ */
+#define URING_BUF_SIZE (1 << 16) //writer / reader 每個 buffer 的大小
+#define URING_DEPTH 8 //預設 buffer 數量(-q 可調整)
+
+typedef struct uring_req uring_req_t;
+struct uring_req {
+    void (*complete)(uring_req_t* req, int res);
+};
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned entries;
+    unsigned sq_local_tail; //已填好但還沒公布給 kernel 的 SQE
+    unsigned to_submit;
+    unsigned long long enters; //io_uring_enter 次數
+} uring_t;
+
+static inline void uring_init(uring_t* ring, unsigned entries){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring -> fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring -> fd == -1){
+        perror("io_uring_setup failed");
+        exit(1);
+    }
+    ring -> entries = params.sq_entries;
+    ring -> sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring -> cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){ //SQ 與 CQ ring 共用一次 mmap
+        if(ring -> cq_size > ring -> sq_size)
+            ring -> sq_size = ring -> cq_size;
+        ring -> cq_size = ring -> sq_size;
+    }
+    ring -> sq_ptr = mmap(0, ring -> sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring -> fd, IORING_OFF_SQ_RING);
+    if(ring -> sq_ptr == MAP_FAILED){
+        perror("mmap sq ring failed");
+        exit(1);
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        ring -> cq_ptr = ring -> sq_ptr;
+    }
+    else{
+        ring -> cq_ptr = mmap(0, ring -> cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring -> fd, IORING_OFF_CQ_RING);
+        if(ring -> cq_ptr == MAP_FAILED){
+            perror("mmap cq ring failed");
+            exit(1);
+        }
+    }
+    ring -> sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring -> sqes = mmap(0, ring -> sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring -> fd, IORING_OFF_SQES);
+    if(ring -> sqes == MAP_FAILED){
+        perror("mmap sqes failed");
+        exit(1);
+    }
+    ring -> sq_head = (unsigned*)((char*)ring -> sq_ptr + params.sq_off.head);
+    ring -> sq_tail = (unsigned*)((char*)ring -> sq_ptr + params.sq_off.tail);
+    ring -> sq_mask = (unsigned*)((char*)ring -> sq_ptr + params.sq_off.ring_mask);
+    ring -> sq_array = (unsigned*)((char*)ring -> sq_ptr + params.sq_off.array);
+    ring -> cq_head = (unsigned*)((char*)ring -> cq_ptr + params.cq_off.head);
+    ring -> cq_tail = (unsigned*)((char*)ring -> cq_ptr + params.cq_off.tail);
+    ring -> cq_mask = (unsigned*)((char*)ring -> cq_ptr + params.cq_off.ring_mask);
+    ring -> cqes = (struct io_uring_cqe*)((char*)ring -> cq_ptr + params.cq_off.cqes);
+    ring -> sq_local_tail = *ring -> sq_tail;
+}
+
+static inline void uring_exit(uring_t* ring){
+    munmap(ring -> sqes, ring -> sqes_size);
+    if(ring -> cq_ptr != ring -> sq_ptr)
+        munmap(ring -> cq_ptr, ring -> cq_size);
+    munmap(ring -> sq_ptr, ring -> sq_size);
+    close(ring -> fd);
+}
+
+//公布已填好的 SQE，送出並(wait_nr > 0 時)等待至少 wait_nr 個 completion，一次 syscall
+static inline void uring_enter(uring_t* ring, unsigned wait_nr){
+    int submitted;
+    __atomic_store_n(ring -> sq_tail, ring -> sq_local_tail, __ATOMIC_RELEASE);
+    do{
+        submitted = syscall(__NR_io_uring_enter, ring -> fd, ring -> to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        ring -> enters++;
+    }while(submitted == -1 && errno == EINTR);
+    if(submitted == -1){
+        perror("io_uring_enter failed");
+        exit(1);
+    }
+    ring -> to_submit -= submitted;
+}
+
+//SQ 滿時先把已填好的送出
+static inline struct io_uring_sqe* uring_get_sqe(uring_t* ring){
+    unsigned index;
+    struct io_uring_sqe* sqe;
+    while(ring -> sq_local_tail - __atomic_load_n(ring -> sq_head, __ATOMIC_ACQUIRE) >= ring -> entries)
+        uring_enter(ring, 0);
+    index = ring -> sq_local_tail & *ring -> sq_mask;
+    sqe = &ring -> sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring -> sq_array[index] = index;
+    ring -> sq_local_tail++;
+    ring -> to_submit++;
+    return sqe;
+}
+
+//處理 CQ 中所有已完成的 request，不需要 syscall
+static inline unsigned uring_reap(uring_t* ring){
+    unsigned head = *ring -> cq_head;
+    unsigned count = 0;
+    while(head != __atomic_load_n(ring -> cq_tail, __ATOMIC_ACQUIRE)){
+        struct io_uring_cqe* cqe = &ring -> cqes[head & *ring -> cq_mask];
+        uring_req_t* req = (uring_req_t*)(unsigned long)cqe -> user_data;
+        int res = cqe -> res;
+        head++;
+        __atomic_store_n(ring -> cq_head, head, __ATOMIC_RELEASE); //先還 CQE 再呼叫 complete，complete 中可以再提交
+        req -> complete(req, res);
+        count++;
+    }
+    return count;
+}
+
+//至少等到一個 completion
+static inline void uring_wait(uring_t* ring){
+    if(uring_reap(ring) == 0){
+        uring_enter(ring, 1);
+        uring_reap(ring);
+    }
+}
+
+/*
+ * ---------- 依序寫入的 batched writer ----------
+ * 資料先累積在 count 個 buffer 中，buffer 滿了才以 IORING_OP_WRITE 送出，
+ * 同時送出的幾個 buffer 用 IOSQE_IO_LINK 串成一條 chain，kernel 會依序執行，
+ * 前一條 chain 完成前不送下一條，所以 pipe / socket 中的資料順序與寫入順序相同。
+ * 寫入不完整時 chain 後面的 SQE 會被取消(-ECANCELED)，等 chain 結束後再依序以 write() 補寫。
+ */
+enum { URING_FREE, URING_FILLING, URING_FILLED, URING_INFLIGHT, URING_RETRY };
+
+typedef struct uring_writer uring_writer_t;
+
+typedef struct {
+    uring_req_t req; //必須是第一個欄位，completion 時轉回 uring_wbuf_t
+    uring_writer_t* writer;
+    char* data;
+    size_t len;
+    size_t written;
+    int state;
+} uring_wbuf_t;
+
+struct uring_writer {
+    uring_t ring;
+    int fd;
+    unsigned count;
+    size_t size;
+    uring_wbuf_t* bufs;
+    char* memory;
+    unsigned fill; //正在填的 buffer
+    unsigned submit_next; //下一個要送出的 buffer
+    unsigned chain_start, chain_len; //進行中的 chain
+    unsigned chain_pending; //chain 中還沒完成的 SQE
+    unsigned long long writes; //補寫時的 write() 次數
+};
+
+static inline void uring_writer_complete(uring_req_t* req, int res){
+    uring_wbuf_t* buf = (uring_wbuf_t*)req;
+    buf -> writer -> chain_pending--;
+    if(res >= 0 && (size_t)res == buf -> len - buf -> written){
+        buf -> state = URING_FREE;
+        return;
+    }
+    if(res < 0 && res != -ECANCELED && res != -EINTR && res != -EAGAIN){
+        fprintf(stderr, "io_uring write failed: %s\n", strerror(-res));
+        exit(1);
+    }
+    if(res > 0)
+        buf -> written += res;
+    buf -> state = URING_RETRY;
+}
+
+static inline void uring_writer_init(uring_writer_t* writer, int fd, unsigned count, size_t size){
+    uring_init(&writer -> ring, count);
+    writer -> fd = fd;
+    writer -> count = count;
+    writer -> size = size;
+    writer -> bufs = calloc(count, sizeof(uring_wbuf_t));
+    writer -> memory = malloc(count * size);
+    if(!writer -> bufs || !writer -> memory){
+        perror("malloc failed");
+        exit(1);
+    }
+    for(unsigned i = 0; i < count; i++){
+        writer -> bufs[i].req.complete = uring_writer_complete;
+        writer -> bufs[i].writer = writer;
+        writer -> bufs[i].data = writer -> memory + i * size;
+    }
+    writer -> fill = writer -> submit_next = 0;
+    writer -> chain_start = writer -> chain_len = writer -> chain_pending = 0;
+    writer -> writes = 0;
+}
+
+//chain 全部完成後，把寫一半或被取消的 buffer 依序補寫完
+static inline void uring_writer_settle(uring_writer_t* writer){
+    for(unsigned i = 0; i < writer -> chain_len; i++){
+        uring_wbuf_t* buf = &writer -> bufs[(writer -> chain_start + i) % writer -> count];
+        if(buf -> state != URING_RETRY) //已完成的 buffer 可能已經被拿去重新填寫
+            continue;
+        while(buf -> written < buf -> len){
+            ssize_t written = write(writer -> fd, buf -> data + buf -> written, buf -> len - buf -> written);
+            writer -> writes++;
+            if(written == -1 && errno != EINTR){
+                perror("write failed");
+                exit(1);
+            }
+            if(written > 0)
+                buf -> written += written;
+        }
+        buf -> state = URING_FREE;
+    }
+    writer -> chain_len = 0;
+}
+
+//上一條 chain 已完成時，把所有填好的 buffer 串成新的 chain 送出
+static inline void uring_writer_submit(uring_writer_t* writer){
+    uring_reap(&writer -> ring);
+    if(writer -> chain_pending > 0)
+        return;
+    uring_writer_settle(writer);
+    writer -> chain_start = writer -> submit_next;
+    while(writer -> bufs[writer -> submit_next].state == URING_FILLED){
+        uring_wbuf_t* buf = &writer -> bufs[writer -> submit_next];
+        struct io_uring_sqe* sqe = uring_get_sqe(&writer -> ring);
+        sqe -> opcode = IORING_OP_WRITE;
+        sqe -> fd = writer -> fd;
+        sqe -> addr = (unsigned long)buf -> data;
+        sqe -> len = buf -> len;
+        sqe -> off = (__u64)-1; //使用目前的檔案位置，pipe / socket 也適用
+        sqe -> flags = IOSQE_IO_LINK;
+        sqe -> user_data = (unsigned long)&buf -> req;
+        buf -> state = URING_INFLIGHT;
+        writer -> chain_len++;
+        writer -> chain_pending++;
+        writer -> submit_next = (writer -> submit_next + 1) % writer -> count;
+    }
+    if(writer -> chain_len == 0)
+        return;
+    writer -> ring.sqes[(writer -> ring.sq_local_tail - 1) & *writer -> ring.sq_mask].flags = 0; //chain 的最後一個不再 link
+    uring_enter(&writer -> ring, 0);
+}
+
+//回傳可以寫入 len bytes 的位置，len 不可超過 size；目前的 buffer 不夠時換下一個，必要時等待
+static inline char* uring_writer_reserve(uring_writer_t* writer, size_t len){
+    uring_wbuf_t* buf = &writer -> bufs[writer -> fill];
+    if(buf -> state == URING_FILLING && buf -> len + len > writer -> size){
+        buf -> state = URING_FILLED;
+        writer -> fill = (writer -> fill + 1) % writer -> count;
+        uring_writer_submit(writer);
+        buf = &writer -> bufs[writer -> fill];
+    }
+    while(buf -> state != URING_FREE && buf -> state != URING_FILLING){ //所有 buffer 都在等 kernel 寫出
+        uring_wait(&writer -> ring);
+        uring_writer_submit(writer);
+    }
+    if(buf -> state == URING_FREE){
+        buf -> state = URING_FILLING;
+        buf -> len = 0;
+        buf -> written = 0;
+    }
+    return buf -> data + buf -> len;
+}
+
+static inline void uring_writer_commit(uring_writer_t* writer, size_t len){
+    writer -> bufs[writer -> fill].len += len;
+}
+
+//把未滿的 buffer 也送出，回傳時所有資料都已交給 kernel(最後一條 chain 可能還在進行)
+static inline void uring_writer_flush(uring_writer_t* writer){
+    uring_wbuf_t* buf = &writer -> bufs[writer -> fill];
+    if(buf -> state == URING_FILLING && buf -> len > 0){
+        buf -> state = URING_FILLED;
+        writer -> fill = (writer -> fill + 1) % writer -> count;
+    }
+    uring_writer_submit(writer);
+    while(writer -> bufs[writer -> submit_next].state == URING_FILLED){
+        uring_wait(&writer -> ring);
+        uring_writer_submit(writer);
+    }
+}
+
+//flush 並等所有寫入完成
+static inline void uring_writer_drain(uring_writer_t* writer){
+    uring_writer_flush(writer);
+    while(writer -> chain_pending > 0)
+        uring_wait(&writer -> ring);
+    uring_writer_settle(writer);
+}
+
+//超過一個 buffer 的資料先 drain 再直接 write，確保順序
+static inline void uring_writer_write(uring_writer_t* writer, const char* data, size_t len){
+    if(len > writer -> size){
+        uring_writer_drain(writer);
+        while(len > 0){
+            ssize_t written = write(writer -> fd, data, len);
+            writer -> writes++;
+            if(written == -1){
+                if(errno == EINTR)
+                    continue;
+                perror("write failed");
+                exit(1);
+            }
+            data += written;
+            len -= written;
+        }
+        return;
+    }
+    memcpy(uring_writer_reserve(writer, len), data, len);
+    uring_writer_commit(writer, len);
+}
+
+static inline unsigned long long uring_writer_syscalls(uring_writer_t* writer){
+    return writer -> ring.enters + writer -> writes;
+}
+
+static inline void uring_writer_close(uring_writer_t* writer){
+    uring_writer_drain(writer);
+    uring_exit(&writer -> ring);
+    free(writer -> bufs);
+    free(writer -> memory);
+}
+
+/*
+ * ---------- 雙 buffer 的 reader ----------
+ * 呼叫者處理其中一個 buffer 時，另一個 buffer 的 IORING_OP_READ 已經在 kernel 中進行。
+ */
+typedef struct {
+    uring_req_t req;
+    char* data;
+    int res;
+    int done;
+} uring_rbuf_t;
+
+typedef struct {
+    uring_t ring;
+    int fd;
+    size_t size;
+    uring_rbuf_t bufs[2];
+    unsigned cur;
+    int started;
+    int eof;
+} uring_reader_t;
+
+static inline void uring_reader_complete(uring_req_t* req, int res){
+    uring_rbuf_t* buf = (uring_rbuf_t*)req;
+    buf -> res = res;
+    buf -> done = 1;
+}
+
+static inline void uring_reader_init(uring_reader_t* reader, int fd, size_t size){
+    uring_init(&reader -> ring, 2);
+    reader -> fd = fd;
+    reader -> size = size;
+    reader -> cur = 0;
+    reader -> started = 0;
+    reader -> eof = 0;
+    for(int i = 0; i < 2; i++){
+        reader -> bufs[i].req.complete = uring_reader_complete;
+        reader -> bufs[i].data = malloc(size);
+        if(!reader -> bufs[i].data){
+            perror("malloc failed");
+            exit(1);
+        }
+    }
+}
+
+static inline void uring_reader_start(uring_reader_t* reader, unsigned index){
+    struct io_uring_sqe* sqe = uring_get_sqe(&reader -> ring);
+    sqe -> opcode = IORING_OP_READ;
+    sqe -> fd = reader -> fd;
+    sqe -> addr = (unsigned long)reader -> bufs[index].data;
+    sqe -> len = reader -> size;
+    sqe -> off = (__u64)-1; //pipe / stdin 沒有 offset
+    sqe -> user_data = (unsigned long)&reader -> bufs[index].req;
+    reader -> bufs[index].done = 0;
+    uring_enter(&reader -> ring, 0);
+}
+
+//下一個 buffer 是否已經讀好，不需要 syscall
+static inline int uring_reader_ready(uring_reader_t* reader){
+    if(!reader -> started)
+        return 0;
+    uring_reap(&reader -> ring);
+    return reader -> bufs[reader -> cur].done;
+}
+
+//回傳下一段資料的長度(EOF 時為 0)，*data 在下一次呼叫前有效
+static inline size_t uring_reader_next(uring_reader_t* reader, char** data){
+    uring_rbuf_t* buf;
+    if(reader -> eof)
+        return 0;
+    if(!reader -> started){
+        uring_reader_start(reader, reader -> cur);
+        reader -> started = 1;
+    }
+    buf = &reader -> bufs[reader -> cur];
+    while(!buf -> done)
+        uring_wait(&reader -> ring);
+    if(buf -> res == -EINTR || buf -> res == -EAGAIN){
+        uring_reader_start(reader, reader -> cur);
+        return uring_reader_next(reader, data);
+    }
+    if(buf -> res < 0){
+        fprintf(stderr, "io_uring read failed: %s\n", strerror(-buf -> res));
+        exit(1);
+    }
+    if(buf -> res == 0){
+        reader -> eof = 1;
+        return 0;
+    }
+    reader -> cur ^= 1;
+    uring_reader_start(reader, reader -> cur); //呼叫者處理這段資料時先讀下一段
+    *data = buf -> data;
+    return buf -> res;
+}
+
+static inline void uring_reader_close(uring_reader_t* reader){
+    //EOF 之後不會再有進行中的 read；中途結束時 close ring 會取消它
+    uring_exit(&reader -> ring);
+    free(reader -> bufs[0].data);
+    free(reader -> bufs[1].data);
+}
+
+#endif
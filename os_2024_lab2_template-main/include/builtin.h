@@ -12,6 +12,8 @@ int cd(char **args);
 int echo(char **args);
 int exit_shell(char **args);
 int record(char **args);
+int hash(char **args);
+int bench(char **args);
 
 extern const char *builtin_str[];
 
@@ -0,0 +1,28 @@
+#ifndef HASH_H
+#define HASH_H
+
+#define HASH_BUCKETS 64 //command 路徑快取的 bucket 數，必須為 2 的次方
+#define HASH_DEFAULT_PATH "/bin:/usr/bin" //沒有設定 PATH 時與 execvp 相同的預設值
+
+/*
+ * 與 bash 的 hash 相同：第一次執行某個命令時沿 PATH 找到它的絕對路徑並記下來，
+ * 之後直接以 posix_spawn / execv 執行該路徑，不必每次都讓 execvp 在 PATH 的每個目錄試一次 execve。
+ * PATH 改變、或 PATH 中在命令所在目錄之前(含)的目錄 mtime 改變(新增 / 刪除了檔案)時清空快取重新查找。
+ */
+
+//FNV-1a，builtin 的 hash table 也使用
+static inline unsigned int hash_string(const char *s)
+{
+	unsigned int h = 2166136261u;
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+const char *hash_lookup(const char *name);
+void hash_clear();
+void hash_print();
+
+#endif
@@ -1,11 +1,19 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include <stdio.h>
+#include <sys/types.h>
 #include "command.h"
 
+extern int last_status;
+
 int spawn_proc(struct cmd_node *);
+int fork_proc(struct cmd_node *);
+pid_t spawn_cmd_node(struct cmd_node *p, int in_fd, int *pipe_fd);
 int fork_cmd_node(struct cmd *cmd);
-void redirection(struct cmd_code *cmd);
+void redirection(struct cmd_node *cmd);
+int run_line(char *buffer);
 void shell();
+int run_script(FILE *file);
 
 #endif
@@ -1,4 +1,6 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "include/shell.h"
 #include "include/command.h"
 
@@ -7,14 +9,49 @@ char *history[MAX_RECORD_NUM];
 
 int main(int argc, char *argv[])
 {
+	int status = 0;
+
 	history_count = 0;
 	for (int i = 0; i < MAX_RECORD_NUM; ++i)
     	history[i] = (char *)malloc(BUF_SIZE * sizeof(char));
 
-	shell();
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) { //my_shell -c 'cmd'
+		if (argc < 3) {
+			fprintf(stderr, "usage: %s [-c command | script]\n", argv[0]);
+			status = 2;
+		}
+		else if (argv[2][0] != '\0') {
+			FILE *script = fmemopen(argv[2], strlen(argv[2]), "r");
+			if (script == NULL) {
+				perror("fmemopen");
+				status = 1;
+			}
+			else {
+				run_script(script);
+				fclose(script);
+				status = last_status;
+			}
+		}
+	}
+	else if (argc > 1) { //my_shell file.sh
+		FILE *script = fopen(argv[1], "re"); //close-on-exec，子進程不會繼承腳本的 fd
+		if (script == NULL) {
+			perror(argv[1]);
+			status = 127;
+		}
+		else {
+			run_script(script);
+			fclose(script);
+			status = last_status; //與 sh 相同，結束狀態為最後一個命令的結束狀態
+		}
+	}
+	else {
+		shell();
+		status = last_status;
+	}
 
 	for (int i = 0; i < MAX_RECORD_NUM; ++i)
     	free(history[i]);
 
-	return 0;
+	return status;
 }
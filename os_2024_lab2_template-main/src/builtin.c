@@ -6,13 +6,34 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <time.h>
 #include "../include/builtin.h"
+#include "../include/shell.h"
+#include "../include/hash.h"
 
 
 
+#define BUILTIN_BUCKETS 16 //builtin 名稱的 hash table，必須為 2 的次方且大於 builtin 數
+
+static int builtin_table[BUILTIN_BUCKETS]; //存 builtin 編號 + 1，0 為空
+static bool builtin_table_ready = false;
+
+//以 hash_string() 建立 open addressing(linear probing) 的 table
+static void build_builtin_table()
+{
+	for (int i = 0; i < num_builtins(); ++i) {
+		unsigned int slot = hash_string(builtin_str[i]) & (BUILTIN_BUCKETS - 1);
+		while (builtin_table[slot])
+			slot = (slot + 1) & (BUILTIN_BUCKETS - 1);
+		builtin_table[slot] = i + 1;
+	}
+	builtin_table_ready = true;
+}
+
 /**
  * @brief 
  * Determine whether cmd is a built-in command
+ * One hash and usually a single strcmp instead of comparing with every builtin
  * @param cmd Command structure
  * @return int 
  * If command is built-in command return function number
@@ -20,10 +41,18 @@
  */
 int searchBuiltInCommand(struct cmd_node *cmd)
 {
-	for (int i = 0; i < num_builtins(); ++i){
-		if (strcmp(cmd->args[0], builtin_str[i]) == 0){
+	unsigned int slot;
+
+	if (cmd->args[0] == NULL)
+		return -1;
+	if (!builtin_table_ready)
+		build_builtin_table();
+	slot = hash_string(cmd->args[0]) & (BUILTIN_BUCKETS - 1);
+	while (builtin_table[slot]) {
+		int i = builtin_table[slot] - 1;
+		if (strcmp(cmd->args[0], builtin_str[i]) == 0)
 			return i;
-		}
+		slot = (slot + 1) & (BUILTIN_BUCKETS - 1);
 	}
 	return -1;
 }
@@ -57,10 +86,12 @@ int cd(char **args)
 {
 	if(args[1] == NULL){
 		fprintf(stderr, "expected argument to \"cd\"\n");
+		last_status = 1;
 	}
 	else{
 		if(chdir(args[1]) != 0){ //chdir切換目錄到指定位子(args[1])
 			perror("cd");
+			last_status = 1;
 		}
 	}
 	return 1;
@@ -74,6 +105,7 @@ int pwd(char **args)
         printf("%s\n", cwd);
     } else {
         perror("pwd");
+        last_status = 1;
     }
     return 1;
 }
@@ -98,6 +130,8 @@ int echo(char **args)
 
 int exit_shell(char **args)
 {
+	if (args[1]) //exit n：以 n 作為結束狀態，否則為上一個命令的結束狀態
+		last_status = atoi(args[1]);
 	return 0;
 }
 
@@ -113,6 +147,80 @@ int record(char **args)
 	return 1;
 }
 
+/**
+ * @brief Show or change the command path cache, like bash's "hash"
+ * usage: hash          list cached commands and their hits
+ *        hash -r       forget every cached path
+ *        hash name...  look up names along PATH and cache them
+ * @param args Command arguments
+ * @return int 
+ * Return execution status
+ */
+int hash(char **args)
+{
+	if (args[1] == NULL) {
+		hash_print();
+		return 1;
+	}
+	if (strcmp(args[1], "-r") == 0) {
+		hash_clear();
+		return 1;
+	}
+	for (int i = 1; args[i]; ++i) {
+		if (hash_lookup(args[i]) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", args[i]);
+			last_status = 1;
+		}
+	}
+	return 1;
+}
+
+static double bench_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Run an external command <count> times with fork() + execv() and with posix_spawn,
+ * report commands/s of both paths
+ * usage: bench <count> <command> [args...], e.g. "bench 1000 true"
+ * @param args Command arguments
+ * @return int 
+ * Return execution status
+ */
+int bench(char **args)
+{
+	struct cmd_node node = {0};
+	int count;
+	double start, fork_time, spawn_time;
+
+	if (args[1] == NULL || args[2] == NULL || (count = atoi(args[1])) <= 0) {
+		fprintf(stderr, "usage: bench <count> <command> [args...]\n");
+		last_status = 2;
+		return 1;
+	}
+	node.args = &args[2];
+	node.out = 1;
+	fflush(stdout); //子進程會繼承 stdout，先把 shell 自己的輸出送出
+
+	start = bench_seconds();
+	for (int i = 0; i < count; ++i)
+		fork_proc(&node);
+	fork_time = bench_seconds() - start;
+
+	start = bench_seconds();
+	for (int i = 0; i < count; ++i)
+		spawn_proc(&node);
+	spawn_time = bench_seconds() - start;
+
+	printf("fork + execv : %d commands in %.3f s, %.0f commands/s\n", count, fork_time, count / fork_time);
+	printf("posix_spawn  : %d commands in %.3f s, %.0f commands/s\n", count, spawn_time, count / spawn_time);
+	printf("speedup      : %.2fx\n", fork_time / spawn_time);
+	return 1;
+}
+
 const char *builtin_str[] = {
  	"help",
  	"cd",
@@ -120,6 +228,8 @@ const char *builtin_str[] = {
 	"echo",
  	"exit",
  	"record",
+	"hash",
+	"bench",
 };
 
 const int (*builtin_func[]) (char **) = {
@@ -129,6 +239,8 @@ const int (*builtin_func[]) (char **) = {
 	&echo,
 	&exit_shell,
   	&record,
+	&hash,
+	&bench,
 };
 
 int num_builtins() {
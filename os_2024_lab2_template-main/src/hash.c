@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/hash.h"
+
+struct hash_entry {
+	char *name;
+	char *path; //絕對路徑
+	int dir; //在 PATH 中第幾個目錄找到
+	unsigned int hits;
+	struct hash_entry *next;
+};
+
+static struct hash_entry *buckets[HASH_BUCKETS];
+static char *hash_path; //建立快取時的 PATH
+static char **dirs; //PATH 拆開後的目錄
+static struct timespec *dir_mtime; //每個目錄當時的 mtime，stat 失敗(目錄不存在)時為 0
+static int dir_count;
+
+/**
+ * @brief Remove every cached path (builtin "hash -r")
+ *
+ */
+void hash_clear()
+{
+	for (int i = 0; i < HASH_BUCKETS; ++i) {
+		while (buckets[i]) {
+			struct hash_entry *entry = buckets[i];
+			buckets[i] = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+		}
+	}
+}
+
+static void dir_stat(int i)
+{
+	struct stat st;
+	if (stat(dirs[i], &st) == 0)
+		dir_mtime[i] = st.st_mtim;
+	else
+		memset(&dir_mtime[i], 0, sizeof(dir_mtime[i]));
+}
+
+//拆開 PATH 並記下每個目錄的 mtime，空的項目代表目前目錄
+static void load_path(const char *path)
+{
+	char *copy, *start, *end;
+
+	for (int i = 0; i < dir_count; ++i)
+		free(dirs[i]);
+	free(dirs);
+	free(dir_mtime);
+	free(hash_path);
+	hash_path = strdup(path);
+
+	dir_count = 1;
+	for (const char *c = path; *c; ++c)
+		if (*c == ':')
+			++dir_count;
+	dirs = (char **)malloc(dir_count * sizeof(char *));
+	dir_mtime = (struct timespec *)malloc(dir_count * sizeof(struct timespec));
+	if (hash_path == NULL || dirs == NULL || dir_mtime == NULL) {
+		perror("Unable to allocate PATH");
+		exit(1);
+	}
+
+	copy = strdup(path);
+	start = copy;
+	for (int i = 0; i < dir_count; ++i) {
+		end = strchr(start, ':');
+		if (end)
+			*end = '\0';
+		dirs[i] = strdup(*start ? start : ".");
+		dir_stat(i);
+		start = end + 1;
+	}
+	free(copy);
+}
+
+//目錄 0 ~ last 中有任何一個 mtime 改變時回傳 false
+static bool dirs_unchanged(int last)
+{
+	for (int i = 0; i <= last && i < dir_count; ++i) {
+		struct timespec old = dir_mtime[i];
+		dir_stat(i);
+		if (old.tv_sec != dir_mtime[i].tv_sec || old.tv_nsec != dir_mtime[i].tv_nsec)
+			return false;
+	}
+	return true;
+}
+
+//沿 PATH 找可執行的一般檔案，只用 stat / access，不會 execve
+static struct hash_entry *resolve(const char *name, unsigned int bucket)
+{
+	char candidate[4096];
+	struct stat st;
+
+	for (int i = 0; i < dir_count; ++i) {
+		if (snprintf(candidate, sizeof(candidate), "%s/%s", dirs[i], name) >= (int)sizeof(candidate))
+			continue;
+		if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+			struct hash_entry *entry = (struct hash_entry *)malloc(sizeof(struct hash_entry));
+			if (entry == NULL) {
+				perror("Unable to allocate hash entry");
+				exit(1);
+			}
+			entry->name = strdup(name);
+			entry->path = strdup(candidate);
+			entry->dir = i;
+			entry->hits = 0;
+			entry->next = buckets[bucket];
+			buckets[bucket] = entry;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Find the executable for a command name
+ * Names containing '/' are returned unchanged, other names are looked up in the cache
+ * and resolved along PATH on a miss
+ * @param name Command name (args[0])
+ * @return const char*
+ * Return the path to execute, valid until the cache is cleared; NULL when the command is not found
+ */
+const char *hash_lookup(const char *name)
+{
+	const char *path = getenv("PATH");
+	unsigned int bucket = hash_string(name) & (HASH_BUCKETS - 1);
+	struct hash_entry *entry;
+
+	if (strchr(name, '/'))
+		return name;
+	if (path == NULL)
+		path = HASH_DEFAULT_PATH;
+	if (hash_path == NULL || strcmp(hash_path, path) != 0) { //PATH 改變
+		hash_clear();
+		load_path(path);
+	}
+
+	for (entry = buckets[bucket]; entry; entry = entry->next) {
+		if (strcmp(entry->name, name) == 0)
+			break;
+	}
+	if (entry && !dirs_unchanged(entry->dir)) { //前面的目錄可能多了同名的命令，或命令已被刪除
+		hash_clear();
+		load_path(path);
+		entry = NULL;
+	}
+	if (entry == NULL)
+		entry = resolve(name, bucket);
+	if (entry == NULL)
+		return NULL;
+	++entry->hits;
+	return entry->path;
+}
+
+/**
+ * @brief List the cache in bash's "hash" format
+ *
+ */
+void hash_print()
+{
+	bool empty = true;
+	for (int i = 0; i < HASH_BUCKETS; ++i) {
+		for (struct hash_entry *entry = buckets[i]; entry; entry = entry->next) {
+			if (empty)
+				printf("hits\tcommand\n");
+			empty = false;
+			printf("%4u\t%s\n", entry->hits, entry->path);
+		}
+	}
+	if (empty)
+		printf("hash: hash table empty\n");
+}
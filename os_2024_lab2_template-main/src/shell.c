@@ -6,8 +6,25 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <spawn.h>
 #include "../include/command.h"
 #include "../include/builtin.h"
+#include "../include/shell.h"
+#include "../include/hash.h"
+
+extern char **environ;
+
+int last_status = 0; //上一個命令的結束狀態，與 sh 的 $? 相同；script mode 結束時作為 my_shell 的結束狀態
+
+//waitpid 的 status 轉成 sh 的結束狀態：正常結束為 exit code，被訊號中止為 128 + 訊號編號
+static int exit_code(int status)
+{
+	if(WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
 
 // ======================= requirement 2.3 =======================
 /**
@@ -55,38 +72,158 @@ void redirection(struct cmd_node *p){ //文件重定向
 // ======================= requirement 2.2 =======================
 /**
  * @brief 
- * Execute external command
+ * Execute external command with fork() + execv()
  * The external command is mainly divided into the following two steps:
  * 1. Call "fork()" to create child process
- * 2. Call "execvp()" to execute the corresponding executable file
+ * 2. Call "execv()" to execute the path found by hash_lookup()
+ * spawn_proc() uses posix_spawn instead, this path is kept for comparison (builtin "bench")
  * @param p cmd_node structure
  * @return int 
  * Return execution status
  */
-int spawn_proc(struct cmd_node *p) //執行單一外部命令
+int fork_proc(struct cmd_node *p) //以 fork 執行單一外部命令
 {
-	pid_t pid = fork(); //創建子進程
+	const char *path = hash_lookup(p -> args[0]); //在父進程查，快取才會留下來
+	pid_t pid;
 	pid_t wpid;
 	int status;
 
+	if(path == NULL){
+		fprintf(stderr, "%s: command not found\n", p -> args[0]);
+		last_status = 127;
+		return 1;
+	}
+	pid = fork(); //創建子進程
 	if(pid == -1){ //創建子進程失敗
 		perror("fork");
+		last_status = 126;
 	}
 	else if(pid == 0){ //處於子進程
 		redirection(p); //重定向
-		if(execvp(p -> args[0], p -> args) == -1){ //呼叫execvp執行外部命令
-			perror("execvp");
-			exit(EXIT_FAILURE);
+		if(execv(path, p -> args) == -1){ //呼叫execv執行外部命令
+			perror("execv");
+			exit(126);
 		}
 	}
 	else{ //處於父進程
 		do{
 			wpid = waitpid(pid, &status, 0); //父進程等待子進程結束
-		}while(!WIFEXITED(status) && !WIFSIGNALED(status)); //檢查是否正常退出或被訊號中止
+		}while(wpid != -1 && !WIFEXITED(status) && !WIFSIGNALED(status)); //檢查是否正常退出或被訊號中止
 		//子進程正常退出時，WIFEXITED(status)會回傳true。
 		//子進程因未捕獲的訊號中止時，WIFSIGNALED(status)回傳true。
 		// => 子進程未正常退出 且 未被訊號中止時，會持續進入迴圈
+		if(wpid != -1)
+			last_status = exit_code(status);
+	}
+  	return 1;
+}
+
+/**
+ * @brief 
+ * Start one command with posix_spawn() on the path cached by hash_lookup()
+ * fork() has to copy the shell's page tables before execv() replaces them,
+ * posix_spawn (clone with CLONE_VM | CLONE_VFORK in glibc) shares the parent's memory until exec,
+ * so its cost does not grow with the size of the shell.
+ * The child's dup2() / close() are done by file actions in the same order as
+ * fork_cmd_node() + redirection(): pipe ends first, then "<" / ">" files.
+ * The "<" / ">" files are opened here in the parent, so a missing file is reported
+ * with its name and status 1, the same as redirection(), instead of as a spawn failure.
+ * @param p cmd_node structure
+ * @param in_fd Read end of the previous pipe, STDIN_FILENO when there is none
+ * @param pipe_fd Pipe to the next command, NULL for the last command
+ * @return pid_t 
+ * Return the child's pid, -1 on failure (last_status is set to 1 when a "<" / ">" file cannot be opened,
+ * 127 when the command is not found, 126 otherwise)
+ */
+pid_t spawn_cmd_node(struct cmd_node *p, int in_fd, int *pipe_fd)
+{
+	posix_spawn_file_actions_t actions;
+	const char *path;
+	pid_t pid;
+	int in_file_fd = -1, out_file_fd = -1;
+	int err;
+
+	if(p -> args[0] == NULL){ //例如 "ls |" 最後一段沒有命令
+		fprintf(stderr, "spawn: empty command\n");
+		last_status = 127;
+		return -1;
+	}
+	if((path = hash_lookup(p -> args[0])) == NULL){ //PATH 中找不到就不必建立子進程
+		fprintf(stderr, "%s: command not found\n", p -> args[0]);
+		last_status = 127;
+		return -1;
+	}
+	//O_CLOEXEC：dup2 到 0 / 1 的那一份會保留，原本的 fd 在 exec 時關閉，也不會漏給其他子進程
+	if(p -> in_file && (in_file_fd = open(p -> in_file, O_RDONLY | O_CLOEXEC)) == -1){
+		fprintf(stderr, "open input file %s: %s\n", p -> in_file, strerror(errno));
+		last_status = 1;
+		return -1;
+	}
+	if(p -> out_file && (out_file_fd = open(p -> out_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1){
+		fprintf(stderr, "open output file %s: %s\n", p -> out_file, strerror(errno));
+		if(in_file_fd != -1)
+			close(in_file_fd);
+		last_status = 1;
+		return -1;
+	}
+	if((err = posix_spawn_file_actions_init(&actions)) != 0){
+		fprintf(stderr, "posix_spawn_file_actions_init: %s\n", strerror(err));
+		if(in_file_fd != -1)
+			close(in_file_fd);
+		if(out_file_fd != -1)
+			close(out_file_fd);
+		last_status = 126;
+		return -1;
+	}
+	if(in_fd != STDIN_FILENO){ //上一個指令的輸出作為標準輸入
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+		posix_spawn_file_actions_addclose(&actions, in_fd);
+	}
+	if(pipe_fd != NULL){ //標準輸出接到管道的寫入端，讀取端給下一個命令
+		posix_spawn_file_actions_adddup2(&actions, pipe_fd[1], STDOUT_FILENO);
+		posix_spawn_file_actions_addclose(&actions, pipe_fd[1]);
+		posix_spawn_file_actions_addclose(&actions, pipe_fd[0]);
 	}
+	if(in_file_fd != -1) //文件重定向在管道之後，覆蓋管道的標準輸入 / 輸出
+		posix_spawn_file_actions_adddup2(&actions, in_file_fd, STDIN_FILENO);
+	if(out_file_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, out_file_fd, STDOUT_FILENO);
+
+	//exec 失敗等錯誤都由 posix_spawn 的回傳值得知，不需要等子進程結束
+	err = posix_spawn(&pid, path, &actions, NULL, p -> args, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if(in_file_fd != -1) //子進程已經有自己的一份
+		close(in_file_fd);
+	if(out_file_fd != -1)
+		close(out_file_fd);
+	if(err != 0){
+		fprintf(stderr, "posix_spawn %s: %s\n", p -> args[0], strerror(err));
+		last_status = err == ENOENT ? 127 : 126; //重定向的檔案已在上面處理，ENOENT 只可能是執行檔(例如在 hash 之後被刪除)
+		return -1;
+	}
+	return pid;
+}
+
+/**
+ * @brief 
+ * Execute external command with posix_spawn, see spawn_cmd_node()
+ * @param p cmd_node structure
+ * @return int 
+ * Return execution status
+ */
+int spawn_proc(struct cmd_node *p) //執行單一外部命令
+{
+	pid_t pid = spawn_cmd_node(p, STDIN_FILENO, NULL);
+	pid_t wpid;
+	int status;
+
+	if(pid == -1)
+		return 1;
+	do{
+		wpid = waitpid(pid, &status, 0); //等待子進程結束
+	}while(wpid != -1 && !WIFEXITED(status) && !WIFSIGNALED(status));
+	if(wpid != -1)
+		last_status = exit_code(status);
   	return 1;
 }
 // ===============================================================
@@ -96,7 +233,7 @@ int spawn_proc(struct cmd_node *p) //執行單一外部命令
 /**
  * @brief 
  * Use "pipe()" to create a communication bridge between processes
- * Call "spawn_proc()" in order according to the number of cmd_node
+ * Call "spawn_cmd_node()" in order according to the number of cmd_node
  * @param cmd Command structure  
  * @return int
  * Return execution status 
@@ -106,7 +243,7 @@ int fork_cmd_node(struct cmd *cmd) //處理多個命令並串接管道
 	struct cmd_node *current = cmd -> head;
 	int pipe_fd[2];
 	int in_fd = STDIN_FILENO;
-	pid_t pid;
+	pid_t pid, last_pid = -1;
 	int status;
 
 	//歷遍cmd_node的鏈表 //current為一個命令
@@ -119,111 +256,161 @@ int fork_cmd_node(struct cmd *cmd) //處理多個命令並串接管道
 			}
 		}
 
-		//創建子進程
-		pid = fork();
-		if(pid == -1){
-			perror("fork");
-			exit(EXIT_FAILURE);
-		}
-		else if(pid == 0){
-			//子進程進行I/O重定向 //管道重定向
-			if(in_fd != STDIN_FILENO){ //in_fd != STDIN_FILENO表示上一個指令的輸出已接至in_fd
-				if(dup2(in_fd, STDIN_FILENO) == -1){ //在此將in_fd(上個命令的輸出) 作為此管道的標準輸入
-					perror("dup2 input");
-					exit(EXIT_FAILURE);
-				}
-				close(in_fd);
-			}
-			if(current -> next != NULL){ //若此命令非最後一個
-				if(dup2(pipe_fd[1], STDOUT_FILENO) == -1){ //則將當前命令的標準輸出設為當前管道的寫入端，供下個命令使用
-					perror("dup2 output");
-					exit(EXIT_FAILURE);
-				}
-				close(pipe_fd[1]);
-				close(pipe_fd[0]);
-			}
+		//以 posix_spawn 創建子進程，管道與文件重定向在子進程 exec 前完成
+		//失敗時(例如命令不存在)仍繼續串接，下一個命令會讀到 EOF
+		pid = spawn_cmd_node(current, in_fd, current -> next != NULL ? pipe_fd : NULL);
+		if(current -> next == NULL)
+			last_pid = pid;
 
-			redirection(current); //文件重定向
-
-			if(execvp(current -> args[0], current -> args) == -1){ //呼叫execvp執行命令
-				perror("execvp");
-				exit(EXIT_FAILURE);
-			}
+		//父進程在每個命令執行完後，確認若fd 非 STDIN_FILENO，則關閉in_fd以釋放資源
+		if(in_fd != STDIN_FILENO){
+			close(in_fd);
 		}
-		else{
-			//父進程在每個命令執行完後，確認若fd 非 STDIN_FILENO，則關閉in_fd以釋放資源
-			if(in_fd != STDIN_FILENO){
-				close(in_fd);
-			}
-			if(current -> next != NULL){ //若非最後一個命令
-				close(pipe_fd[1]); //則關閉寫入端
-				in_fd = pipe_fd[0]; //將當前管道的讀取端傳給下一個命令的in_fd
-			}
-
-			current = current -> next; //移動到下個命令
+		if(current -> next != NULL){ //若非最後一個命令
+			close(pipe_fd[1]); //則關閉寫入端
+			in_fd = pipe_fd[0]; //將當前管道的讀取端傳給下一個命令的in_fd
 		}
+
+		current = current -> next; //移動到下個命令
 	}
 
-	while((pid == wait(&status)) > 0); //等所有子進程結束
+	while((pid = wait(&status)) > 0){ //等所有子進程結束
+		if(pid == last_pid) //管道的結束狀態為最後一個命令的結束狀態
+			last_status = exit_code(status);
+	}
 	
 	return 1;
 }
 // ===============================================================
 
 
-void shell()
+/**
+ * @brief 
+ * Parse and execute one command line
+ * @param buffer Command line without '\n', split_line() modifies it in place
+ * @return int 
+ * Return execution status, 0 when the shell should exit
+ */
+int run_line(char *buffer)
 {
-	while (1) {
-		printf(">>> $ ");
-		char *buffer = read_line();
-		if (buffer == NULL)
-			continue;
+	struct cmd *cmd = split_line(buffer);
+	
+	int status = -1;
+	// only a single command
+	struct cmd_node *temp = cmd->head;
+	
+	if(temp->next == NULL){
+		status = searchBuiltInCommand(temp);
+		if (status != -1){
+			// 只有在有重定向時才需要保存 shell 的 stdin 和 stdout
+			int in = -1, out = -1;
+			if (temp->in_file && (in = dup(STDIN_FILENO)) == -1)
+				perror("dup");
+			if (temp->out_file && (out = dup(STDOUT_FILENO)) == -1)
+				perror("dup");
+			redirection(temp);
+			last_status = 0; //builtin 失敗時自己設定 last_status
+			status = execBuiltInCommand(status,temp);
 
-		struct cmd *cmd = split_line(buffer);
-		
-		int status = -1;
-		// only a single command
-		struct cmd_node *temp = cmd->head;
-		
-		if(temp->next == NULL){
-			status = searchBuiltInCommand(temp);
-			if (status != -1){
-				int in = dup(STDIN_FILENO), out = dup(STDOUT_FILENO);
-				if( in == -1 | out == -1)
-					perror("dup");
-				redirection(temp);
-				status = execBuiltInCommand(status,temp);
-
-				// recover shell stdin and stdout
-				if (temp->in_file)  dup2(in, 0);
-				if (temp->out_file){
-					dup2(out, 1);
-				}
+			// recover shell stdin and stdout
+			if (temp->in_file){
+				dup2(in, 0);
 				close(in);
-				close(out);
 			}
-			else{
-				//external command
-				status = spawn_proc(cmd->head);
+			if (temp->out_file){
+				fflush(stdout); //builtin 的輸出要在還原 stdout 前寫進檔案
+				dup2(out, 1);
+				close(out);
 			}
 		}
-		// There are multiple commands ( | )
 		else{
-			
-			status = fork_cmd_node(cmd);
+			//external command
+			fflush(stdout); //stdout 不是終端機時為 full buffering，先送出之前 builtin 的輸出以保持順序
+			status = spawn_proc(cmd->head);
+		}
+	}
+	// There are multiple commands ( | )
+	else{
+		fflush(stdout);
+		status = fork_cmd_node(cmd);
+	}
+	// free space
+	while (cmd->head) {
+		
+		struct cmd_node *temp = cmd->head;
+		cmd->head = cmd->head->next;
+		free(temp->args);
+		free(temp);
+	}
+	free(cmd);
+	return status;
+}
+
+void shell()
+{
+	while (1) {
+		printf(">>> $ ");
+		char *buffer = read_line();
+		if (buffer == NULL){
+			if (feof(stdin) || ferror(stdin)) //輸入結束(例如 Ctrl-D)
+				break;
+			continue;
 		}
-		// free space
-		while (cmd->head) {
-			
-			struct cmd_node *temp = cmd->head;
-      		cmd->head = cmd->head->next;
-			free(temp->args);
-   	    	free(temp);
-   		}
-		free(cmd);
+
+		int status = run_line(buffer);
 		free(buffer);
 		
 		if (status == 0)
 			break;
 	}
 }
+
+static double script_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 
+ * Script mode ("my_shell -c 'cmd'" and "my_shell file.sh")
+ * Every line is read into the same buffer and executed right away, without a prompt or history.
+ * Leading spaces / tabs are skipped, empty lines and lines starting with '#' are ignored.
+ * Report the number of command lines and commands/s on stderr at exit.
+ * The exit status of the last command is left in last_status.
+ * @param file Script to execute
+ * @return int 
+ * Return execution status, 0 when the script ran "exit"
+ */
+int run_script(FILE *file)
+{
+	char buffer[BUF_SIZE]; //整個腳本共用，不會每行 malloc
+	long commands = 0;
+	int status = 1;
+	double start = script_seconds(), elapsed;
+
+	while (status != 0 && fgets(buffer, BUF_SIZE, file) != NULL) {
+		size_t len = strcspn(buffer, "\n");
+		char *line = buffer + strspn(buffer, " \t");
+
+		if (buffer[len] != '\n' && !feof(file)) { //超過 BUF_SIZE 的一行，略過剩下的部分
+			int c;
+			fprintf(stderr, "my_shell: line longer than %d characters skipped\n", BUF_SIZE - 2);
+			while ((c = fgetc(file)) != EOF && c != '\n');
+			continue;
+		}
+		buffer[len] = '\0';
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		status = run_line(line);
+		++commands;
+	}
+
+	fflush(stdout);
+	elapsed = script_seconds() - start;
+	fprintf(stderr, "my_shell: %ld commands in %.3f s, %.0f commands/s\n",
+		commands, elapsed, elapsed > 0 ? commands / elapsed : 0.0);
+	return status;
+}